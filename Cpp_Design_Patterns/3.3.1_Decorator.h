@@ -14,6 +14,18 @@ to consider for the job.*/
 #include <string>
 #include <iostream>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm> // std::min
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h> // writev
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits> // IOV_MAX
+#include <cerrno>
+#endif
 
 // Our Abstract base class
 class Car1 {
@@ -29,6 +41,11 @@ public:
 
 	virtual double getCost() = 0; // Pure virtual
 
+	// The car wrapped by this one, or nullptr for a base model
+	virtual Car1* getDecorated() {
+		return nullptr;
+	}
+
 	virtual ~Car1() {
 		std::cout << "~Car()" << std::endl;
 	}
@@ -40,6 +57,16 @@ public:
 
 	// virtual std::string getDescription() = 0; // Pure virtual
 
+	// Cost of this option alone, excluding the car it decorates
+	virtual double getOptionCost() = 0; // Pure virtual
+
+	// Every decorator wraps a car
+	virtual Car1* getDecorated() override = 0; // Pure virtual
+
+	virtual double getCost() override {
+		return getOptionCost() + getDecorated()->getCost();
+	}
+
 	virtual ~OptionsDecorator() {
 		std::cout << "~OptionsDecorator()" << std::endl;
 	}
@@ -72,8 +99,12 @@ public:
 		return m_b->getDescription() + ", Navigation";
 	}
 
-	double getCost() {
-		return 300.56 + m_b->getCost();
+	double getOptionCost() {
+		return 300.56;
+	}
+
+	Car1* getDecorated() {
+		return m_b.get();
 	}
 	~Navigation() {
 		std::cout << "~Navigation()" << std::endl;
@@ -89,8 +120,12 @@ public:
 		return m_b->getDescription() + ", PremiumSoundSystem";
 	}
 
-	double getCost(){
-		return 0.30 + m_b->getCost();
+	double getOptionCost() {
+		return 0.30;
+	}
+
+	Car1* getDecorated() {
+		return m_b.get();
 	}
 	~PremiumSoundSystem() {
 		std::cout << "~PremiumSoundSystem()" << std::endl;
@@ -106,8 +141,12 @@ public:
 		return m_b->getDescription() + ", ManualTransmission";
 	}
 
-	double getCost() {
-		return 0.30 + m_b->getCost();
+	double getOptionCost() {
+		return 0.30;
+	}
+
+	Car1* getDecorated() {
+		return m_b.get();
 	}
 	~ManualTransmission() {
 		std::cout << "~ManualTransmission()" << std::endl;
@@ -147,18 +186,259 @@ CarModel1, Navigation, PremiumSoundSystem, ManualTransmission will cost you $313
 ~Car()
 */
 
+/* Sealing a decorator chain
+
+Every getCost() query above recurses through each OptionsDecorator layer with one
+virtual call per layer, even though the chain never changes once it is built.
+SealedCar takes ownership of a finished chain and fuses it into a flat cost plan:
+the base model price followed by each option price, innermost first. The total is
+memoized, so a query is just a load.
+
+If the chain is changed (e.g. with addOption()) the plan is invalidated and rebuilt
+on the next query. Anyone mutating the chain through getDecorated() must call
+invalidate() themselves. Both take each option's price from getOptionCost(),
+and the plan is summed in the same order as the recursive getCost(), so sealed and
+unsealed costs are bit-for-bit identical. */
+
+class SealedCar : public Car1 {
+	std::unique_ptr<Car1> m_b;
+	std::vector<double> m_plan; // base model cost, then option costs innermost first
+	double m_cost;
+	bool m_sealed;
+
+public:
+	SealedCar(std::unique_ptr<Car1>&& b) : m_b(std::move(b)), m_cost(0.0), m_sealed(false) {
+		seal();
+	}
+
+	// Flatten the chain into m_plan and memoize the total
+	void seal() {
+		std::vector<double> options;
+		Car1* car = m_b.get();
+		// Only OptionsDecorator reports a decorated car, anything else is the base model
+		for (Car1* inner = car->getDecorated(); inner != nullptr; inner = inner->getDecorated()) {
+			options.push_back(static_cast<OptionsDecorator*>(car)->getOptionCost());
+			car = inner;
+		}
+
+		m_plan.clear();
+		m_plan.push_back(car->getCost());
+		m_plan.insert(m_plan.end(), options.rbegin(), options.rend());
+
+		m_cost = m_plan[0];
+		for (size_t i = 1; i < m_plan.size(); ++i) {
+			m_cost = m_plan[i] + m_cost;
+		}
+		m_sealed = true;
+	}
+
+	void invalidate() {
+		m_sealed = false;
+	}
+
+	bool isSealed() const {
+		return m_sealed;
+	}
+
+	const std::vector<double>& getCostPlan() {
+		if (!m_sealed) {
+			seal();
+		}
+		return m_plan;
+	}
+
+	// Wrap the sealed chain in another option; the plan is rebuilt lazily
+	template <typename Option>
+	void addOption() {
+		m_b = std::make_unique<Option>(std::move(m_b));
+		invalidate();
+	}
+
+	std::string getDescription() override {
+		return m_b->getDescription();
+	}
+
+	double getCost() override {
+		if (!m_sealed) {
+			seal();
+		}
+		return m_cost;
+	}
+};
+
+void decorator_sealed() {
+	std::unique_ptr<Car1> b = std::make_unique<CarModel1>();
+	b = std::make_unique<Navigation>(std::move(b));
+	b = std::make_unique<PremiumSoundSystem>(std::move(b));
+
+	SealedCar sealed(std::move(b));
+	std::cout << sealed.getDescription() << " will cost you $" << sealed.getCost() << std::endl;
+
+	sealed.addOption<ManualTransmission>();
+	std::cout << sealed.getDescription() << " will cost you $" << sealed.getCost() << std::endl;
+}
+
+// Query a deep chain many times, recursively and sealed
+void decorator_benchmark(unsigned depth = 32, unsigned queries = 10000000) {
+	std::unique_ptr<Car1> b = std::make_unique<CarModel1>();
+	for (unsigned i = 0; i < depth; ++i) {
+		switch (i % 3) {
+		case 0: b = std::make_unique<Navigation>(std::move(b)); break;
+		case 1: b = std::make_unique<PremiumSoundSystem>(std::move(b)); break;
+		default: b = std::make_unique<ManualTransmission>(std::move(b)); break;
+		}
+	}
+
+	volatile double sink = 0.0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < queries; ++i) {
+		sink = b->getCost();
+	}
+	auto recursive = std::chrono::steady_clock::now() - start;
+
+	SealedCar sealed(std::move(b));
+	Car1& car = sealed;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < queries; ++i) {
+		sink = car.getCost();
+	}
+	auto fused = std::chrono::steady_clock::now() - start;
+
+	std::cout << "Decorator chain of depth " << depth << ", " << queries << " getCost() queries:" << std::endl
+		<< "  recursive: " << std::chrono::duration_cast<std::chrono::milliseconds>(recursive).count() << " ms" << std::endl
+		<< "  sealed:    " << std::chrono::duration_cast<std::chrono::milliseconds>(fused).count() << " ms" << std::endl;
+	(void)sink;
+}
+
 // Another example(C++14):
 
+/* Decorating a message by editing a std::string copies the whole body for every
+salutation prepended, so a deep stack over a large body costs O(size x depth).
+
+A Message is instead a list of segments (pointer and length, like an iovec) that
+refer to text owned by someone else: the body by the caller, salutations and
+valedictions by the decorators. Prefixes and suffixes are pushed onto either end
+without touching the body. The referenced text must outlive the Message. */
+class Message {
+public:
+	struct Segment {
+		const char* data;
+		size_t size;
+	};
+
+private:
+	std::deque<Segment> m_segments;
+	size_t m_size;
+
+public:
+	Message() : m_size(0) {}
+
+	explicit Message(const std::string& body) : m_size(0) {
+		append(body);
+	}
+
+	// A temporary string would be gone before the Message is written
+	explicit Message(std::string&&) = delete;
+
+	void prepend(const char* data, size_t size) {
+		m_segments.push_front(Segment{ data, size });
+		m_size += size;
+	}
+
+	void prepend(const std::string& str) {
+		prepend(str.data(), str.size());
+	}
+
+	void prepend(std::string&&) = delete;
+
+	void append(const char* data, size_t size) {
+		m_segments.push_back(Segment{ data, size });
+		m_size += size;
+	}
+
+	void append(const std::string& str) {
+		append(str.data(), str.size());
+	}
+
+	void append(std::string&&) = delete;
+
+	const std::deque<Segment>& segments() const {
+		return m_segments;
+	}
+
+	// Total length in bytes
+	size_t size() const {
+		return m_size;
+	}
+
+	// Gather into a single string (copies once)
+	std::string str() const {
+		std::string result;
+		result.reserve(m_size);
+		for (const Segment& s : m_segments) {
+			result.append(s.data, s.size);
+		}
+		return result;
+	}
+
+	void writeTo(std::ostream& os) const {
+		for (const Segment& s : m_segments) {
+			os.write(s.data, static_cast<std::streamsize>(s.size));
+		}
+	}
+
+#if defined(__unix__) || defined(__APPLE__)
+	// Gather write of every segment to a file descriptor. Returns false on error.
+	bool writeTo(int fd) const {
+		std::vector<iovec> iov;
+		iov.reserve(m_segments.size());
+		for (const Segment& s : m_segments) {
+			if (s.size != 0) {
+				iov.push_back(iovec{ const_cast<char*>(s.data), s.size });
+			}
+		}
+
+		size_t first = 0;
+		while (first < iov.size()) {
+			int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+			ssize_t written = ::writev(fd, &iov[first], count);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+
+			// Skip what was written, trimming a partially written segment
+			size_t remaining = static_cast<size_t>(written);
+			while (first < iov.size() && remaining >= iov[first].iov_len) {
+				remaining -= iov[first].iov_len;
+				++first;
+			}
+			if (remaining != 0) {
+				iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + remaining;
+				iov[first].iov_len -= remaining;
+			}
+		}
+		return true;
+	}
+#endif
+};
+
 class Interface {
 public:
 	virtual ~Interface() { }
 	virtual void write(std::string&) = 0;
+	virtual void write(Message&) = 0;
 };
 
 class Core : public Interface {
 public:
 	~Core() { std::cout << "Core destructor" << std::endl; }
 	virtual void write(std::string& text) override { /* Do nothing*/ }; 
+	virtual void write(Message&) override { /* Do nothing*/ };
 };
 
 class Decorator : public Interface {
@@ -167,6 +447,7 @@ class Decorator : public Interface {
 public:
 	Decorator(std::unique_ptr<Interface> c) { interface = std::move(c); }
 	virtual void write(std::string& text) override { interface->write(text); }
+	virtual void write(Message& message) override { interface->write(message); }
 };
 
 class MessengerWithSalutation : public Decorator {
@@ -181,6 +462,11 @@ public:
 		text = salutation + "\n" + text;
 		Decorator::write(text);
 	}
+	virtual void write(Message& message) override {
+		message.prepend("\n", 1);
+		message.prepend(salutation);
+		Decorator::write(message);
+	}
 };
 
 class MessengerWithValediction : public Decorator {
@@ -195,6 +481,11 @@ public:
 		Decorator::write(text);
 		text += "\n" + valediction;
 	}
+	virtual void write(Message& message) override {
+		Decorator::write(message);
+		message.append("\n", 1);
+		message.append(valediction);
+	}
 };
 
 void decorator2() {
@@ -249,4 +540,79 @@ MessengerWithValediction destructor
 Core destructor
 Messenger destructor
 Core destructor
-Core destructor*/
\ No newline at end of file
+Core destructor*/
+
+// The same messengers assembling a scatter/gather Message instead of editing a string
+void decorator_message() {
+	const std::string salutation = "Greetings,";
+	const std::string valediction = "Sincerly, Andy";
+	const std::string body = "This message is assembled from segments.";
+
+	std::unique_ptr<Interface> messenger = std::make_unique<MessengerWithValediction>(std::make_unique<MessengerWithSalutation>
+		(std::make_unique<Core>(), salutation), valediction);
+
+	Message message(body);
+	messenger->write(message);
+	message.writeTo(std::cout);
+	std::cout << "\n------------------------------\n";
+}
+
+// Decorate MB-sized bodies through a deep messenger stack, by string and by Message
+void decorator_message_benchmark(size_t bodySize = 4 * 1024 * 1024, unsigned depth = 16, unsigned iterations = 20) {
+	const std::string salutation = "Greetings,";
+	const std::string valediction = "Sincerly, Andy";
+	const std::string body(bodySize, 'x');
+
+	std::unique_ptr<Interface> messenger = std::make_unique<Core>();
+	for (unsigned i = 0; i < depth; ++i) {
+		if (i % 2 == 0) {
+			messenger = std::make_unique<MessengerWithSalutation>(std::move(messenger), salutation);
+		}
+		else {
+			messenger = std::make_unique<MessengerWithValediction>(std::move(messenger), valediction);
+		}
+	}
+
+#if defined(__unix__) || defined(__APPLE__)
+	int fd = ::open("/dev/null", O_WRONLY);
+#endif
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < iterations; ++i) {
+		std::string text = body;
+		messenger->write(text);
+#if defined(__unix__) || defined(__APPLE__)
+		for (size_t done = 0; done < text.size();) {
+			ssize_t written = ::write(fd, text.data() + done, text.size() - done);
+			if (written <= 0) {
+				break;
+			}
+			done += static_cast<size_t>(written);
+		}
+#endif
+	}
+	auto copying = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < iterations; ++i) {
+		Message message(body);
+		messenger->write(message);
+#if defined(__unix__) || defined(__APPLE__)
+		message.writeTo(fd);
+#endif
+	}
+	auto gathering = std::chrono::steady_clock::now() - start;
+
+#if defined(__unix__) || defined(__APPLE__)
+	::close(fd);
+#endif
+
+	auto mbPerSecond = [&](std::chrono::steady_clock::duration d) {
+		double seconds = std::chrono::duration<double>(d).count();
+		return static_cast<double>(bodySize) * iterations / (1024.0 * 1024.0) / (seconds > 0.0 ? seconds : 1e-9);
+	};
+
+	std::cout << "Messenger stack of depth " << depth << ", " << iterations << " bodies of " << bodySize << " bytes:" << std::endl
+		<< "  std::string: " << mbPerSecond(copying) << " MB/s" << std::endl
+		<< "  Message:     " << mbPerSecond(gathering) << " MB/s" << std::endl;
+}
\ No newline at end of file
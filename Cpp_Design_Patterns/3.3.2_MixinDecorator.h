@@ -0,0 +1,282 @@
+#pragma once
+
+/* Compile-time (mixin) decorators
+
+Both decorator examples in 3.3.1_Decorator.h decide the decoration at run time:
+every layer is a separate heap allocation held by a unique_ptr, and every call
+walks the layers through one virtual call each.
+
+When the set of decorations is already known at compile time the same layering
+can be expressed with mixins: each option is a class template deriving from the
+thing it decorates, and the stack is assembled by the compiler. The result is one
+flat object with no heap allocation, no vtable, and calls that inline down to a
+single expression:
+
+	Decorate<CarModel1Mixin, NavigationMixin, PremiumSoundSystemMixin> car;
+	car.getCost(); // 0.30 + (300.56 + 31000.23), all inlined
+
+The price is flexibility: options can no longer be added to an existing object. */
+
+#include <string>
+#include <iostream>
+#include <memory>
+#include <chrono>
+#include <utility> // std::forward, std::index_sequence
+#include <tuple>
+
+#include "3.3.1_Decorator.h"
+
+/* Decorate<Core, A, B, C> is C<B<A<Core>>>, i.e. the options are listed in the
+order they would have been wrapped at run time (innermost first).
+
+Each layer takes its own constructor arguments first and forwards the rest to the
+layer it decorates, so the nested type takes them outermost first. Decorate takes
+them in the order of its template list instead, innermost first, one per stateful
+layer: Decorate<CoreMixin, SalutationMixin, ValedictionMixin>(salutation, valediction). */
+template <class Stack>
+class InTemplateOrder : public Stack {
+	template <typename Tuple, size_t... I>
+	InTemplateOrder(Tuple&& args, std::index_sequence<I...>)
+		: Stack(std::get<sizeof...(I) - 1 - I>(std::move(args))...) {}
+
+public:
+	template <typename... Args>
+	explicit InTemplateOrder(Args&&... args)
+		: InTemplateOrder(std::forward_as_tuple(std::forward<Args>(args)...), std::index_sequence_for<Args...>()) {}
+};
+
+template <class Core, template <class> class... Options>
+struct Decorated {
+	using type = Core;
+};
+
+template <class Core, template <class> class First, template <class> class... Rest>
+struct Decorated<Core, First, Rest...> {
+	using type = typename Decorated<First<Core>, Rest...>::type;
+};
+
+template <class Core, template <class> class... Options>
+using Decorate = InTemplateOrder<typename Decorated<Core, Options...>::type>;
+
+// The cars
+
+class CarModel1Mixin {
+public:
+	std::string getDescription() const {
+		return "CarModel1";
+	}
+
+	double getCost() const {
+		return 31000.23;
+	}
+};
+
+template <class Car>
+class NavigationMixin : public Car {
+public:
+	std::string getDescription() const {
+		return Car::getDescription() + ", Navigation";
+	}
+
+	double getCost() const {
+		return 300.56 + Car::getCost();
+	}
+};
+
+template <class Car>
+class PremiumSoundSystemMixin : public Car {
+public:
+	std::string getDescription() const {
+		return Car::getDescription() + ", PremiumSoundSystem";
+	}
+
+	double getCost() const {
+		return 0.30 + Car::getCost();
+	}
+};
+
+template <class Car>
+class ManualTransmissionMixin : public Car {
+public:
+	std::string getDescription() const {
+		return Car::getDescription() + ", ManualTransmission";
+	}
+
+	double getCost() const {
+		return 0.30 + Car::getCost();
+	}
+};
+
+// The messengers. Decorations carry state: each layer takes its own constructor
+// argument and forwards the rest to the layer it decorates.
+
+class CoreMixin {
+public:
+	void write(std::string&) const { /* Do nothing*/ }
+};
+
+template <class Messenger>
+class SalutationMixin : public Messenger {
+	std::string salutation;
+
+public:
+	template <typename... Args>
+	SalutationMixin(const std::string& str, Args&&... args)
+		: Messenger(std::forward<Args>(args)...), salutation(str) {}
+
+	void write(std::string& text) const {
+		text = salutation + "\n" + text;
+		Messenger::write(text);
+	}
+};
+
+template <class Messenger>
+class ValedictionMixin : public Messenger {
+	std::string valediction;
+
+public:
+	template <typename... Args>
+	ValedictionMixin(const std::string& str, Args&&... args)
+		: Messenger(std::forward<Args>(args)...), valediction(str) {}
+
+	void write(std::string& text) const {
+		Messenger::write(text);
+		text += "\n" + valediction;
+	}
+};
+
+void mixin_decorator() {
+	Decorate<CarModel1Mixin, NavigationMixin, PremiumSoundSystemMixin, ManualTransmissionMixin> car;
+	std::cout << car.getDescription() << " will cost you $" << car.getCost() << std::endl;
+
+	// Same decoration as messenger4 in decorator2()
+	Decorate<CoreMixin, SalutationMixin, ValedictionMixin> messenger("Greetings,", "Sincerly, Andy");
+	std::string message = "This message is decorated with a salutation and a valediction.";
+	messenger.write(message);
+	std::cout << message << std::endl;
+}
+
+/* Compare a three option car built as a runtime unique_ptr chain with the mixin
+stack: construction (and destruction) cost, memory, and getCost() latency. Then the
+same for messenger4 of decorator2(), a salutation and a valediction around the
+core, with write() in place of getCost().
+
+The runtime layers trace their destructors to std::cout, which is muted while
+timing. The muted stream writes are still counted, so the construction figure
+for the runtime chain is somewhat pessimistic. */
+void mixin_decorator_benchmark(unsigned builds = 1000000, unsigned queries = 10000000) {
+	using MixinCar = Decorate<CarModel1Mixin, NavigationMixin, PremiumSoundSystemMixin, ManualTransmissionMixin>;
+
+	auto buildRuntimeCar = []() {
+		std::unique_ptr<Car1> b = std::make_unique<CarModel1>();
+		b = std::make_unique<Navigation>(std::move(b));
+		b = std::make_unique<PremiumSoundSystem>(std::move(b));
+		b = std::make_unique<ManualTransmission>(std::move(b));
+		return b;
+	};
+
+	volatile double sink = 0.0;
+	std::streambuf* coutBuffer = std::cout.rdbuf(nullptr);
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < builds; ++i) {
+		std::unique_ptr<Car1> car = buildRuntimeCar();
+		sink = car->getCost();
+	}
+	auto runtimeBuild = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < builds; ++i) {
+		MixinCar car;
+		sink = car.getCost();
+	}
+	auto mixinBuild = std::chrono::steady_clock::now() - start;
+
+	std::unique_ptr<Car1> runtimeCar = buildRuntimeCar();
+	MixinCar mixinCar;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < queries; ++i) {
+		sink = runtimeCar->getCost();
+	}
+	auto runtimeCall = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < queries; ++i) {
+		sink = mixinCar.getCost();
+	}
+	auto mixinCall = std::chrono::steady_clock::now() - start;
+
+	runtimeCar.reset();
+
+	const std::string salutation = "Greetings,";
+	const std::string valediction = "Sincerly, Andy";
+	const std::string body = "This message is decorated with a salutation and a valediction.";
+	using MixinMessenger = Decorate<CoreMixin, SalutationMixin, ValedictionMixin>;
+
+	auto buildRuntimeMessenger = [&salutation, &valediction]() -> std::unique_ptr<Interface> {
+		return std::make_unique<MessengerWithValediction>(std::make_unique<MessengerWithSalutation>
+			(std::make_unique<Core>(), salutation), valediction);
+	};
+
+	size_t written = 0;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < builds; ++i) {
+		std::unique_ptr<Interface> messenger = buildRuntimeMessenger();
+		written += sizeof(messenger);
+	}
+	auto runtimeMessengerBuild = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < builds; ++i) {
+		MixinMessenger messenger(salutation, valediction);
+		written += sizeof(messenger);
+	}
+	auto mixinMessengerBuild = std::chrono::steady_clock::now() - start;
+
+	std::unique_ptr<Interface> runtimeMessenger = buildRuntimeMessenger();
+	MixinMessenger mixinMessenger(salutation, valediction);
+
+	// Each write() decorates a fresh copy of the body, which costs both the same
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < builds; ++i) {
+		std::string text = body;
+		runtimeMessenger->write(text);
+		written += text.size();
+	}
+	auto runtimeWrite = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < builds; ++i) {
+		std::string text = body;
+		mixinMessenger.write(text);
+		written += text.size();
+	}
+	auto mixinWrite = std::chrono::steady_clock::now() - start;
+
+	runtimeMessenger.reset();
+	std::cout.rdbuf(coutBuffer);
+	std::cout.clear();
+
+	// Heap payload only; each allocation also carries allocator overhead
+	size_t runtimeBytes = sizeof(CarModel1) + sizeof(Navigation) + sizeof(PremiumSoundSystem) + sizeof(ManualTransmission);
+
+	auto ns = [](std::chrono::steady_clock::duration d, unsigned n) {
+		return std::chrono::duration<double, std::nano>(d).count() / n;
+	};
+
+	std::cout << "Three option car, runtime unique_ptr chain vs mixin stack:" << std::endl
+		<< "  build + destroy: " << ns(runtimeBuild, builds) << " ns vs " << ns(mixinBuild, builds) << " ns" << std::endl
+		<< "  memory:          " << runtimeBytes << " bytes in 4 allocations vs " << sizeof(MixinCar) << " bytes inline" << std::endl
+		<< "  getCost():       " << ns(runtimeCall, queries) << " ns vs " << ns(mixinCall, queries) << " ns" << std::endl;
+
+	size_t runtimeMessengerBytes = sizeof(Core) + sizeof(MessengerWithSalutation) + sizeof(MessengerWithValediction);
+
+	std::cout << "Salutation and valediction messenger, runtime unique_ptr chain vs mixin stack:" << std::endl
+		<< "  build + destroy: " << ns(runtimeMessengerBuild, builds) << " ns vs " << ns(mixinMessengerBuild, builds) << " ns" << std::endl
+		<< "  memory:          " << runtimeMessengerBytes << " bytes in 3 allocations vs " << sizeof(MixinMessenger) << " bytes inline" << std::endl
+		<< "  write():         " << ns(runtimeWrite, builds) << " ns vs " << ns(mixinWrite, builds) << " ns" << std::endl;
+	(void)sink;
+	(void)written;
+}
@@ -22,37 +22,76 @@ So when I come and leave I just make one call and it takes care of everything...
 
 #include <string>
 #include <iostream>
+#include <vector>
+#include <map>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
 
-class Alarm {
+/* Each subsystem can be given a simulated latency, standing in for the slow remote
+devices behind a real facade. Messages are written with a single insertion so that
+lines stay whole when subsystems are driven concurrently (see AsyncHouseFacade). */
+
+class Subsystem {
+	std::chrono::milliseconds m_latency;
+
+protected:
+	void simulateLatency() const {
+		if (m_latency.count() > 0) {
+			std::this_thread::sleep_for(m_latency);
+		}
+	}
+
+public:
+	explicit Subsystem(std::chrono::milliseconds latency) : m_latency(latency) {}
+};
+
+class Alarm : public Subsystem {
 public:
+	explicit Alarm(std::chrono::milliseconds latency = std::chrono::milliseconds(0)) : Subsystem(latency) {}
+
 	void alarmOn() {
-		std::cout << "Alarm is on and house is secured" << std::endl;
+		simulateLatency();
+		std::cout << "Alarm is on and house is secured\n";
 	}
 
 	void alarmOff() {
-		std::cout << "Alarm is off and you can go into the house" << std::endl;
+		simulateLatency();
+		std::cout << "Alarm is off and you can go into the house\n";
 	}
 };
 
-class Ac {
+class Ac : public Subsystem {
 public:
+	explicit Ac(std::chrono::milliseconds latency = std::chrono::milliseconds(0)) : Subsystem(latency) {}
+
 	void acOn() {
-		std::cout << "Ac is on" << std::endl;
+		simulateLatency();
+		std::cout << "Ac is on\n";
 	}
 
 	void acOff() {
-		std::cout << "AC is off" << std::endl;
+		simulateLatency();
+		std::cout << "AC is off\n";
 	}
 };
 
-class Tv {
+class Tv : public Subsystem {
 public:
+	explicit Tv(std::chrono::milliseconds latency = std::chrono::milliseconds(0)) : Subsystem(latency) {}
+
 	void tvOn() {
-		std::cout << "TV is on" << std::endl;
+		simulateLatency();
+		std::cout << "TV is on\n";
 	}
 
 	void tvOff() {
-		std::cout << "TV is off" << std::endl;
+		simulateLatency();
+		std::cout << "TV is off\n";
 	}
 };
 
@@ -64,6 +103,9 @@ class HouseFacade {
 public:
 	HouseFacade() {}
 
+	HouseFacade(std::chrono::milliseconds alarmLatency, std::chrono::milliseconds acLatency, std::chrono::milliseconds tvLatency)
+		: alarm(alarmLatency), ac(acLatency), tv(tvLatency) {}
+
 	void goToWork() {
 		ac.acOff();
 		tv.tvOff();
@@ -77,6 +119,97 @@ public:
 	}
 };
 
+/* The subsystems behind a facade are often independent, so there is no need to wait
+for the AC before talking to the TV. AsyncHouseFacade describes each button as a list
+of operations with explicit dependencies, runs every operation on its own thread as
+soon as the operations it depends on have finished, and joins on all of them. An
+exception thrown by an operation is rethrown from the facade call, and operations
+depending on it are not run.
+
+The time each operation took is recorded, so the slowest subsystem is easy to spot. */
+class AsyncHouseFacade {
+public:
+	struct Operation {
+		std::string name;
+		std::function<void()> run;
+		std::vector<size_t> after; // indices of earlier operations that must finish first
+	};
+
+private:
+	Alarm alarm;
+	Ac ac;
+	Tv tv;
+
+	std::map<std::string, std::chrono::microseconds> m_latencies;
+	std::mutex m_latenciesMutex;
+
+public:
+	AsyncHouseFacade() {}
+
+	AsyncHouseFacade(std::chrono::milliseconds alarmLatency, std::chrono::milliseconds acLatency, std::chrono::milliseconds tvLatency)
+		: alarm(alarmLatency), ac(acLatency), tv(tvLatency) {}
+
+	void execute(const std::vector<Operation>& operations) {
+		std::vector<std::shared_future<void> > done;
+		done.reserve(operations.size());
+
+		for (size_t i = 0; i < operations.size(); ++i) {
+			std::vector<std::shared_future<void> > dependencies;
+			for (size_t j : operations[i].after) {
+				if (j >= i) {
+					throw std::invalid_argument("Operation " + operations[i].name + " must only depend on earlier operations");
+				}
+				dependencies.push_back(done[j]);
+			}
+
+			const Operation& operation = operations[i];
+			done.push_back(std::async(std::launch::async, [this, &operation, dependencies]() {
+				for (const std::shared_future<void>& dependency : dependencies) {
+					dependency.get(); // rethrows if a dependency failed
+				}
+
+				auto start = std::chrono::steady_clock::now();
+				operation.run();
+				auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+				std::lock_guard<std::mutex> lock(m_latenciesMutex);
+				m_latencies[operation.name] = elapsed;
+			}).share());
+		}
+
+		for (const std::shared_future<void>& operation : done) {
+			operation.wait();
+		}
+		for (const std::shared_future<void>& operation : done) {
+			operation.get();
+		}
+	}
+
+	void goToWork() {
+		// Arm the alarm only once everything else is off
+		execute({
+			{ "ac.acOff", [this]() { ac.acOff(); }, {} },
+			{ "tv.tvOff", [this]() { tv.tvOff(); }, {} },
+			{ "alarm.alarmOn", [this]() { alarm.alarmOn(); }, { 0, 1 } },
+		});
+	}
+
+	void comeHome() {
+		// Disarm the alarm before anything else
+		execute({
+			{ "alarm.alarmOff", [this]() { alarm.alarmOff(); }, {} },
+			{ "ac.acOn", [this]() { ac.acOn(); }, { 0 } },
+			{ "tv.tvOn", [this]() { tv.tvOn(); }, { 0 } },
+		});
+	}
+
+	// Most recent latency of each operation
+	std::map<std::string, std::chrono::microseconds> getLatencies() {
+		std::lock_guard<std::mutex> lock(m_latenciesMutex);
+		return m_latencies;
+	}
+};
+
 void facade() {
 	HouseFacade hf;
 
@@ -93,4 +226,249 @@ Alarm is on and house is secured
 Alarm is off and you can go into the house
 Ac is on
 Tv is on
+*/
+
+/* With simulated subsystem latencies the sequential facade pays for every subsystem
+in turn, while the concurrent one only pays for its longest chain of dependencies:
+the slowest of AC and TV, plus the alarm that must go before or after them. */
+void facade_concurrent(std::chrono::milliseconds alarmLatency = std::chrono::milliseconds(20),
+	std::chrono::milliseconds acLatency = std::chrono::milliseconds(150),
+	std::chrono::milliseconds tvLatency = std::chrono::milliseconds(80)) {
+
+	HouseFacade sequential(alarmLatency, acLatency, tvLatency);
+	AsyncHouseFacade concurrent(alarmLatency, acLatency, tvLatency);
+
+	auto start = std::chrono::steady_clock::now();
+	sequential.goToWork();
+	sequential.comeHome();
+	auto sequentialTime = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	concurrent.goToWork();
+	concurrent.comeHome();
+	auto concurrentTime = std::chrono::steady_clock::now() - start;
+
+	std::cout << "goToWork() + comeHome(): sequential "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(sequentialTime).count() << " ms, concurrent "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(concurrentTime).count() << " ms" << std::endl;
+
+	for (const auto& latency : concurrent.getLatencies()) {
+		std::cout << "  " << latency.first << ": " << std::chrono::duration<double, std::milli>(latency.second).count() << " ms" << std::endl;
+	}
+}
+
+/* Bursty clients often send redundant button presses, e.g. acOn() immediately followed
+by acOff(). BatchingHouseFacade collects calls for up to maxPending calls or window
+time, whichever comes first, and then flushes them to the subsystems:
+
+- only the last request for each subsystem survives (acOn, acOff -> acOff)
+- a request matching the state the facade last left the subsystem in is dropped
+  (acOff when the AC is already off), so an acOn/acOff pair cancels out entirely
+- the surviving requests keep the order of their last occurrence, so goToWork()
+  still arms the alarm after switching everything else off
+
+Counters report how many requests were received, issued and elided. */
+class BatchingHouseFacade {
+	enum Device { AlarmDevice, AcDevice, TvDevice, DeviceCount };
+	enum State { Unknown, Off, On };
+
+	struct Request {
+		Device device;
+		bool on;
+	};
+
+	Alarm alarm;
+	Ac ac;
+	Tv tv;
+
+	const size_t m_maxPending;
+	const std::chrono::milliseconds m_window;
+
+	std::vector<Request> m_pending;
+	std::chrono::steady_clock::time_point m_deadline;
+	State m_states[DeviceCount]; // as last left by this facade, guarded by m_flushMutex
+
+	size_t m_requested;
+	size_t m_issued;
+	size_t m_elided;
+	size_t m_flushes;
+	bool m_stopping;
+
+	std::mutex m_mutex;       // guards m_pending, m_deadline, counters and m_stopping
+	std::mutex m_flushMutex;  // serialises flushes so batches reach subsystems in order
+	std::condition_variable m_wakeup;
+	std::thread m_timer;
+
+	void issue(const Request& request) {
+		switch (request.device) {
+		case AlarmDevice: request.on ? alarm.alarmOn() : alarm.alarmOff(); break;
+		case AcDevice: request.on ? ac.acOn() : ac.acOff(); break;
+		case TvDevice: request.on ? tv.tvOn() : tv.tvOff(); break;
+		default: break;
+		}
+	}
+
+	void enqueue(Device device, bool on) {
+		bool full = false;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_pending.empty()) {
+				m_deadline = std::chrono::steady_clock::now() + m_window;
+				m_wakeup.notify_one();
+			}
+			m_pending.push_back(Request{ device, on });
+			++m_requested;
+			full = m_pending.size() >= m_maxPending;
+		}
+		if (full) {
+			flush();
+		}
+	}
+
+	// Flushes whatever is pending whenever the window of the oldest request expires
+	void timerLoop() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!m_stopping) {
+			if (m_pending.empty()) {
+				m_wakeup.wait(lock);
+			}
+			else if (m_wakeup.wait_until(lock, m_deadline) == std::cv_status::timeout && !m_pending.empty()
+				&& std::chrono::steady_clock::now() >= m_deadline) {
+				lock.unlock();
+				flush();
+				lock.lock();
+			}
+		}
+	}
+
+public:
+	BatchingHouseFacade(size_t maxPending = 16, std::chrono::milliseconds window = std::chrono::milliseconds(50))
+		: m_maxPending(maxPending), m_window(window), m_requested(0), m_issued(0), m_elided(0), m_flushes(0), m_stopping(false) {
+		for (State& state : m_states) {
+			state = Unknown;
+		}
+		m_timer = std::thread(&BatchingHouseFacade::timerLoop, this);
+	}
+
+	~BatchingHouseFacade() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wakeup.notify_one();
+		m_timer.join();
+		flush();
+	}
+
+	BatchingHouseFacade(const BatchingHouseFacade&) = delete;
+	BatchingHouseFacade& operator=(const BatchingHouseFacade&) = delete;
+
+	void alarmOn() { enqueue(AlarmDevice, true); }
+	void alarmOff() { enqueue(AlarmDevice, false); }
+	void acOn() { enqueue(AcDevice, true); }
+	void acOff() { enqueue(AcDevice, false); }
+	void tvOn() { enqueue(TvDevice, true); }
+	void tvOff() { enqueue(TvDevice, false); }
+
+	void goToWork() {
+		acOff();
+		tvOff();
+		alarmOn();
+	}
+
+	void comeHome() {
+		alarmOff();
+		acOn();
+		tvOn();
+	}
+
+	// Coalesce and send everything pending now, without waiting for the window
+	void flush() {
+		std::lock_guard<std::mutex> flushLock(m_flushMutex);
+
+		std::vector<Request> batch;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			batch.swap(m_pending);
+		}
+		if (batch.empty()) {
+			return;
+		}
+
+		// Keep the last request per device, in order of that last occurrence
+		std::vector<size_t> last(DeviceCount, batch.size());
+		for (size_t i = 0; i < batch.size(); ++i) {
+			last[batch[i].device] = i;
+		}
+
+		size_t issued = 0;
+		for (size_t i = 0; i < batch.size(); ++i) {
+			const Request& request = batch[i];
+			State wanted = request.on ? On : Off;
+			if (last[request.device] != i || m_states[request.device] == wanted) {
+				continue;
+			}
+			issue(request);
+			m_states[request.device] = wanted;
+			++issued;
+		}
+
+		// Issued and elided are counted together, so the counters never include half a batch
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_issued += issued;
+		m_elided += batch.size() - issued;
+		++m_flushes;
+	}
+
+	size_t getRequested() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_requested;
+	}
+
+	size_t getIssued() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_issued;
+	}
+
+	// Requests that never reached a subsystem; requests still pending or being flushed are not counted yet
+	size_t getElided() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_elided;
+	}
+
+	size_t getFlushes() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_flushes;
+	}
+};
+
+void facade_batching() {
+	BatchingHouseFacade hf(16, std::chrono::milliseconds(20));
+
+	// A burst of button presses, most of which cancel out
+	hf.comeHome();
+	hf.acOff();
+	hf.acOn();
+	hf.tvOn();
+	hf.tvOn();
+	hf.goToWork();
+	hf.comeHome();
+	hf.flush();
+
+	// The house is already in the requested state, so nothing is sent
+	hf.acOn();
+	hf.acOff();
+	hf.acOn();
+	std::this_thread::sleep_for(std::chrono::milliseconds(100)); // let the window expire
+
+	std::cout << hf.getRequested() << " requests, " << hf.getIssued() << " issued, " << hf.getElided()
+		<< " elided in " << hf.getFlushes() << " flushes" << std::endl;
+}
+
+/* The output of facade_batching() is:
+
+Alarm is off and you can go into the house
+Ac is on
+TV is on
+16 requests, 3 issued, 13 elided in 2 flushes
 */
\ No newline at end of file
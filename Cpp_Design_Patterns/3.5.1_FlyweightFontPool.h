@@ -0,0 +1,216 @@
+#pragma once
+
+/* A flyweight factory for fonts
+
+In 3.5_Flyweight.h the shared (intrinsic) font state lives in two fixed-size static
+vectors which setFontsAndNames() fills by hand, so every caller has to know the
+indices up front. FontPool is a real flyweight factory: intern(fontName, fontSize)
+returns a compact handle, and interning the same font again returns the same handle.
+
+- Handles are stable: a font never moves once interned, so the pool can grow
+  without bound (up to the 32 bit handle range) while handles stay valid.
+- get(handle) is lock-free. Fonts are stored in chunks that double in size and are
+  never reallocated, so a read is two loads with no locking.
+- intern() is safe to call concurrently. The name/size -> handle lookup is split
+  into shards, each with its own mutex, so threads interning different fonts
+  rarely contend.
+- getMemoryUsage() reports the bytes held by the pool. */
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <functional> // std::hash
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
+#include <cstdint>
+
+using FontHandle = std::uint32_t;
+
+struct Font {
+	std::string name;
+	float size;
+};
+
+class FontPool {
+	struct FontKey {
+		std::string name;
+		float size;
+
+		bool operator==(const FontKey& other) const {
+			return size == other.size && name == other.name;
+		}
+	};
+
+	struct FontKeyHash {
+		size_t operator()(const FontKey& key) const {
+			size_t h = std::hash<std::string>()(key.name);
+			return h ^ (std::hash<float>()(key.size) + 0x9e3779b9 + (h << 6) + (h >> 2));
+		}
+	};
+
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_map<FontKey, FontHandle, FontKeyHash> handles;
+	};
+
+	// Chunk k holds FirstChunkSize << k fonts, so MaxChunks chunks cover every handle
+	static const size_t FirstChunkSize = 64;
+	static const size_t MaxChunks = 27;
+	static const size_t ShardCount = 16;
+
+	std::atomic<Font*> m_chunks[MaxChunks];
+	std::atomic<std::uint64_t> m_next;    // next handle to hand out
+	std::atomic<size_t> m_size;           // fonts fully interned
+	std::atomic<size_t> m_stringBytes;    // heap held by font names
+	Shard m_shards[ShardCount];
+
+	static size_t chunkCapacity(size_t chunk) {
+		return FirstChunkSize << chunk;
+	}
+
+	// Chunk and offset of a handle: chunk k starts at FirstChunkSize * (2^k - 1)
+	static void locate(FontHandle handle, size_t& chunk, size_t& offset) {
+		size_t n = handle / FirstChunkSize + 1;
+		chunk = 0;
+		while (n >>= 1) {
+			++chunk;
+		}
+		offset = handle - FirstChunkSize * ((size_t(1) << chunk) - 1);
+	}
+
+	Font& slot(FontHandle handle) {
+		size_t chunk, offset;
+		locate(handle, chunk, offset);
+
+		Font* fonts = m_chunks[chunk].load(std::memory_order_acquire);
+		if (fonts == nullptr) {
+			// First handle in a new chunk; racing allocators agree on one chunk
+			Font* fresh = new Font[chunkCapacity(chunk)];
+			if (m_chunks[chunk].compare_exchange_strong(fonts, fresh, std::memory_order_acq_rel)) {
+				fonts = fresh;
+			}
+			else {
+				delete[] fresh;
+			}
+		}
+		return fonts[offset];
+	}
+
+	// Heap held by a string beyond the object itself (0 when stored inline)
+	static size_t heapBytes(const std::string& str) {
+		const char* data = str.data();
+		const char* object = reinterpret_cast<const char*>(&str);
+		bool inlined = data >= object && data < object + sizeof(std::string);
+		return inlined ? 0 : str.capacity() + 1;
+	}
+
+public:
+	FontPool() : m_next(0), m_size(0), m_stringBytes(0) {
+		for (std::atomic<Font*>& chunk : m_chunks) {
+			chunk.store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+	~FontPool() {
+		for (std::atomic<Font*>& chunk : m_chunks) {
+			delete[] chunk.load(std::memory_order_relaxed);
+		}
+	}
+
+	FontPool(const FontPool&) = delete;
+	FontPool& operator=(const FontPool&) = delete;
+
+	FontHandle intern(const std::string& fontName, float fontSize) {
+		FontKey key{ fontName, fontSize };
+		size_t hash = FontKeyHash()(key);
+		Shard& shard = m_shards[hash % ShardCount];
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.handles.find(key);
+		if (it != shard.handles.end()) {
+			return it->second;
+		}
+
+		std::uint64_t next = m_next.fetch_add(1, std::memory_order_relaxed);
+		if (next > UINT32_MAX) {
+			throw std::length_error("FontPool is out of handles");
+		}
+		FontHandle handle = static_cast<FontHandle>(next);
+
+		Font& font = slot(handle);
+		font.name = fontName;
+		font.size = fontSize;
+		m_stringBytes.fetch_add(heapBytes(font.name), std::memory_order_relaxed);
+
+		shard.handles.emplace(std::move(key), handle);
+		m_size.fetch_add(1, std::memory_order_release);
+		return handle;
+	}
+
+	// The handle must have come from intern() on this pool
+	const Font& get(FontHandle handle) const {
+		size_t chunk, offset;
+		locate(handle, chunk, offset);
+		return m_chunks[chunk].load(std::memory_order_acquire)[offset];
+	}
+
+	size_t size() const {
+		return m_size.load(std::memory_order_acquire);
+	}
+
+	// Bytes held by the pool: font chunks, font names and the lookup shards.
+	// Hash map nodes are estimated, as their layout is up to the library.
+	size_t getMemoryUsage() {
+		size_t bytes = sizeof(FontPool) + m_stringBytes.load(std::memory_order_relaxed);
+		for (size_t chunk = 0; chunk < MaxChunks; ++chunk) {
+			if (m_chunks[chunk].load(std::memory_order_acquire) != nullptr) {
+				bytes += chunkCapacity(chunk) * sizeof(Font);
+			}
+		}
+		for (Shard& shard : m_shards) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			bytes += shard.handles.bucket_count() * sizeof(void*);
+			for (const auto& entry : shard.handles) {
+				bytes += sizeof(entry) + 2 * sizeof(void*) + heapBytes(entry.first.name);
+			}
+		}
+		return bytes;
+	}
+};
+
+void flyweight_pool() {
+	FontPool pool;
+
+	// Four threads intern the same handful of fonts concurrently
+	const std::vector<std::string> names = { "first_font", "second_font", "third_font" };
+	const std::vector<float> sizes = { 1.0f, 1.5f, 2.0f };
+
+	std::vector<std::thread> threads;
+	std::vector<std::vector<FontHandle> > handles(4);
+	for (size_t t = 0; t < handles.size(); ++t) {
+		threads.emplace_back([&, t]() {
+			for (size_t i = 0; i < 1000; ++i) {
+				handles[t].push_back(pool.intern(names[i % names.size()], sizes[i % sizes.size()]));
+			}
+		});
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	bool stable = true;
+	for (size_t t = 1; t < handles.size(); ++t) {
+		stable = stable && handles[t] == handles[0];
+	}
+
+	std::cout << "Interned " << 4 * 1000 << " fonts into " << pool.size() << " flyweights ("
+		<< (stable ? "handles agree" : "handles differ") << "), pool uses " << pool.getMemoryUsage() << " bytes" << std::endl;
+
+	for (FontHandle handle = 0; handle < pool.size(); ++handle) {
+		const Font& font = pool.get(handle);
+		std::cout << "Handle " << handle << ": " << font.name << " " << font.size << std::endl;
+	}
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+/* A columnar, run-length encoded document of flyweight characters
+
+A std::vector<FlyweightCharacter> spends 8 bytes on every character: two font
+indices plus a 32 bit stream position. For very large documents that is wasteful,
+because the position is just the character's index and consecutive characters
+almost always share a font.
+
+FlyweightDocument stores each attribute in its own column instead:
+
+- the characters themselves, one byte each, indexed by their 64 bit position
+- the font, run-length encoded: one (start position, font handle) pair per run of
+  characters in the same font, also stored as two separate columns
+
+A sparse block index records which run each block of BlockSize positions starts
+in, so looking up the font of a position is a binary search over the few runs of one
+block rather than the whole document. A typical document costs a little over one
+byte per character. Font handles come from a FontPool (see 3.5.1_FlyweightFontPool.h). */
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm> // std::upper_bound
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <stdexcept>
+#include <cstddef> // std::ptrdiff_t
+
+#include "3.5_Flyweight.h"
+#include "3.5.1_FlyweightFontPool.h"
+
+class FlyweightDocument {
+	std::vector<char> m_text;
+	std::vector<std::uint64_t> m_runStarts; // first position of each font run
+	std::vector<FontHandle> m_runFonts;     // font of each run
+	std::vector<size_t> m_blockRuns;        // run containing the first position of each block
+
+	static const std::uint64_t BlockSize = 4096;
+
+	void startRun(FontHandle font) {
+		if (m_runFonts.empty() || m_runFonts.back() != font) {
+			m_runStarts.push_back(m_text.size());
+			m_runFonts.push_back(font);
+		}
+	}
+
+	// Index every block boundary in [from, to) under the current run
+	void indexBlocks(std::uint64_t from, std::uint64_t to) {
+		for (std::uint64_t block = (from + BlockSize - 1) / BlockSize; block * BlockSize < to; ++block) {
+			m_blockRuns.push_back(m_runFonts.size() - 1);
+		}
+	}
+
+public:
+	struct Character {
+		char value;
+		FontHandle font;
+		std::uint64_t position;
+	};
+
+	void append(char value, FontHandle font) {
+		startRun(font);
+		indexBlocks(m_text.size(), m_text.size() + 1);
+		m_text.push_back(value);
+	}
+
+	void append(const std::string& text, FontHandle font) {
+		if (text.empty()) {
+			return;
+		}
+		startRun(font);
+		indexBlocks(m_text.size(), m_text.size() + text.size());
+		m_text.insert(m_text.end(), text.begin(), text.end());
+	}
+
+	void reserve(std::uint64_t characters) {
+		m_text.reserve(static_cast<size_t>(characters));
+	}
+
+	std::uint64_t size() const {
+		return m_text.size();
+	}
+
+	size_t runCount() const {
+		return m_runFonts.size();
+	}
+
+	FontHandle fontAt(std::uint64_t position) const {
+		if (position >= m_text.size()) {
+			throw std::out_of_range("FlyweightDocument position out of range");
+		}
+		// Last run starting at or before position, among the runs overlapping its block
+		size_t block = static_cast<size_t>(position / BlockSize);
+		auto first = m_runStarts.begin() + static_cast<std::ptrdiff_t>(m_blockRuns[block]);
+		auto last = block + 1 < m_blockRuns.size() ? m_runStarts.begin() + static_cast<std::ptrdiff_t>(m_blockRuns[block + 1] + 1) : m_runStarts.end();
+		auto run = std::upper_bound(first, last, position) - 1;
+		return m_runFonts[static_cast<size_t>(run - m_runStarts.begin())];
+	}
+
+	Character at(std::uint64_t position) const {
+		FontHandle font = fontAt(position); // checks position before the text is read
+		return Character{ m_text[static_cast<size_t>(position)], font, position };
+	}
+
+	// Bytes held by the columns (capacity, not just size)
+	size_t getMemoryUsage() const {
+		return sizeof(FlyweightDocument) + m_text.capacity() * sizeof(char)
+			+ m_runStarts.capacity() * sizeof(std::uint64_t) + m_runFonts.capacity() * sizeof(FontHandle)
+			+ m_blockRuns.capacity() * sizeof(size_t);
+	}
+};
+
+void flyweight_document() {
+	FontPool pool;
+	FontHandle body = pool.intern("first_font", 1.0f);
+	FontHandle heading = pool.intern("second_font", 1.5f);
+
+	FlyweightDocument document;
+	document.append("Flyweight", heading);
+	document.append(" documents store fonts once per run.", body);
+
+	for (std::uint64_t position : { 0, 8, 9, 44 }) {
+		FlyweightDocument::Character c = document.at(position);
+		const Font& font = pool.get(c.font);
+		std::cout << "'" << c.value << "' at " << c.position << ": " << font.name << " " << font.size << std::endl;
+	}
+	std::cout << document.size() << " characters in " << document.runCount() << " runs" << std::endl;
+}
+
+/* Bytes per character of the columnar document against std::vector<FlyweightCharacter>,
+for a document whose font changes on average every averageRun characters, plus the
+cost of random access by position. A std::vector<FlyweightCharacter> cannot go past
+2^32 characters at all, as its positions are 32 bit. */
+void flyweight_document_benchmark(std::uint64_t characters = 100000000, unsigned averageRun = 64, unsigned lookups = 10000000) {
+	FontPool pool;
+	const FontHandle fonts[] = { pool.intern("first_font", 1.0f), pool.intern("second_font", 1.5f), pool.intern("third_font", 2.0f) };
+
+	std::mt19937_64 random(42);
+	std::uniform_int_distribution<unsigned> runLength(1, 2 * averageRun - 1);
+
+	FlyweightDocument document;
+	document.reserve(characters);
+	std::vector<FlyweightCharacter> chars;
+	bool vectorFits = characters <= UINT32_MAX;
+	if (vectorFits) {
+		chars.reserve(static_cast<size_t>(characters));
+	}
+
+	unsigned short font = 0;
+	unsigned remaining = runLength(random);
+	for (std::uint64_t i = 0; i < characters; ++i) {
+		if (remaining-- == 0) {
+			font = static_cast<unsigned short>((font + 1) % 3);
+			remaining = runLength(random) - 1;
+		}
+		document.append(static_cast<char>('a' + i % 26), fonts[font]);
+		if (vectorFits) {
+			chars.push_back(FlyweightCharacterAbstractBuilder::createFlyweightCharacter(font, font, static_cast<unsigned>(i)));
+		}
+	}
+
+	std::uniform_int_distribution<std::uint64_t> position(0, characters - 1);
+	volatile FontHandle sink = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < lookups; ++i) {
+		sink = document.fontAt(position(random));
+	}
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	(void)sink;
+
+	std::cout << characters << " characters, " << document.runCount() << " font runs:" << std::endl;
+	if (vectorFits) {
+		std::cout << "  std::vector<FlyweightCharacter>: "
+			<< static_cast<double>(chars.capacity() * sizeof(FlyweightCharacter)) / static_cast<double>(characters) << " bytes/char" << std::endl;
+	}
+	std::cout << "  FlyweightDocument:               "
+		<< static_cast<double>(document.getMemoryUsage()) / static_cast<double>(characters) << " bytes/char (including the text itself)" << std::endl
+		<< "  random fontAt(): " << std::chrono::duration<double, std::nano>(elapsed).count() / lookups << " ns" << std::endl;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+/* Measuring what the flyweight actually saves
+
+The comment in flyweight() estimates the saving per character from the sizes of
+the fields (6 bytes of font name plus 4 bytes of font size, against two 2 byte
+indices). Real objects are padded, and a std::string is much bigger than the
+characters it holds, so this harness measures instead of estimating:
+
+- the footprint of each struct, as the compiler lays it out
+- the heap actually allocated, counted by an allocator given to the containers
+  being measured (and to the naive character's string)
+
+and compares a naive character storing its own font name and size against the
+FlyweightCharacter plus its shared font tables, for 1K up to maxCharacters.
+
+Only what the measured containers allocate is counted, so the rest of the program
+keeps the default allocator. At 100M characters the naive representation needs
+around 4 GB. */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "3.5_Flyweight.h"
+
+namespace allocation_counting {
+	// Bytes currently allocated through any CountingAllocator
+	inline std::atomic<std::int64_t>& bytesLive() {
+		static std::atomic<std::int64_t> bytes(0);
+		return bytes;
+	}
+
+	template <typename T>
+	struct CountingAllocator {
+		using value_type = T;
+
+		CountingAllocator() = default;
+
+		template <typename U>
+		CountingAllocator(const CountingAllocator<U>&) {}
+
+		T* allocate(size_t n) {
+			T* p = std::allocator<T>().allocate(n);
+			bytesLive().fetch_add(static_cast<std::int64_t>(n * sizeof(T)), std::memory_order_relaxed);
+			return p;
+		}
+
+		void deallocate(T* p, size_t n) {
+			bytesLive().fetch_sub(static_cast<std::int64_t>(n * sizeof(T)), std::memory_order_relaxed);
+			std::allocator<T>().deallocate(p, n);
+		}
+	};
+
+	template <typename T, typename U>
+	bool operator==(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+		return true;
+	}
+
+	template <typename T, typename U>
+	bool operator!=(const CountingAllocator<T>&, const CountingAllocator<U>&) {
+		return false;
+	}
+
+	template <typename T>
+	using Vector = std::vector<T, CountingAllocator<T> >;
+
+	// Laid out like std::string, with the same short string buffer
+	using String = std::basic_string<char, std::char_traits<char>, CountingAllocator<char> >;
+}
+
+// A character that keeps its own copy of the intrinsic state
+struct NaiveCharacter {
+	allocation_counting::String fontName;
+	float fontSize;
+	unsigned positionInStream;
+};
+
+void flyweight_memory_benchmark(size_t maxCharacters = 100000000) {
+	const allocation_counting::String names[] = { "first_font", "second_font", "third_font" };
+	const float sizes[] = { 1.0f, 1.5f, 2.0f };
+
+	std::cout << "sizeof(NaiveCharacter) = " << sizeof(NaiveCharacter)
+		<< " (string " << sizeof(allocation_counting::String) << ", float " << sizeof(float) << ", unsigned " << sizeof(unsigned) << ")" << std::endl
+		<< "sizeof(FlyweightCharacter) = " << sizeof(FlyweightCharacter)
+		<< " (estimated in flyweight(): 2 + 2 + 4)" << std::endl;
+
+	std::cout << std::setw(12) << "characters" << std::setw(16) << "naive bytes" << std::setw(16) << "flyweight bytes"
+		<< std::setw(16) << "saved bytes" << std::setw(12) << "saved/char" << std::setw(16) << "estimated saved" << std::endl;
+
+	for (size_t count = 1000; count <= maxCharacters; count *= 10) {
+		std::int64_t before = allocation_counting::bytesLive().load();
+		std::int64_t naiveBytes = 0;
+		{
+			allocation_counting::Vector<NaiveCharacter> chars;
+			chars.reserve(count);
+			for (size_t i = 0; i < count; ++i) {
+				chars.push_back(NaiveCharacter{ names[i % 3], sizes[i % 3], static_cast<unsigned>(i) });
+			}
+			naiveBytes = allocation_counting::bytesLive().load() - before;
+		}
+
+		before = allocation_counting::bytesLive().load();
+		std::int64_t flyweightBytes = 0;
+		{
+			// The shared intrinsic state, as held by FlyweightCharacterAbstractBuilder
+			allocation_counting::Vector<float> fontSizes(sizes, sizes + 3);
+			allocation_counting::Vector<allocation_counting::String> fontNames(names, names + 3);
+
+			allocation_counting::Vector<FlyweightCharacter> chars;
+			chars.reserve(count);
+			for (size_t i = 0; i < count; ++i) {
+				unsigned short font = static_cast<unsigned short>(i % 3);
+				chars.push_back(FlyweightCharacterAbstractBuilder::createFlyweightCharacter(font, font, static_cast<unsigned>(i)));
+			}
+			flyweightBytes = allocation_counting::bytesLive().load() - before;
+		}
+
+		// The estimate from flyweight(): 6 bytes per character, less the shared tables
+		std::int64_t estimated = static_cast<std::int64_t>(count) * 6 - (3 * 6 + 3 * 4);
+		std::int64_t saved = naiveBytes - flyweightBytes;
+
+		std::cout << std::setw(12) << count << std::setw(16) << naiveBytes << std::setw(16) << flyweightBytes
+			<< std::setw(16) << saved << std::setw(12) << static_cast<double>(saved) / static_cast<double>(count)
+			<< std::setw(16) << estimated << std::endl;
+	}
+}
@@ -0,0 +1,330 @@
+#pragma once
+
+/* A memory-mapped flyweight document
+
+Documents made of FlyweightCharacter objects have to be rebuilt in memory on every
+run. This on-disk format stores the intrinsic tables (font sizes and font names)
+and the extrinsic character stream laid out exactly as they are used in memory,
+so a document is opened by mapping the file read-only:
+
+- nothing is parsed or copied; the header is only checked for consistency, and the
+  font indices of a character when it is read
+- pages are read from disk lazily, the first time they are touched
+- any number of processes mapping the same file share one copy in the page cache
+
+Layout (native byte order, every section 8 byte aligned):
+
+	Header
+	float          fontSizes[fontSizeCount]
+	NameEntry      fontNames[fontNameCount]   offset and length into the name blob
+	char           names[namesBytes]
+	MappedCharacter characters[characterCount]
+
+The file is written by writeFlyweightDocument() and opened by
+MappedFlyweightDocument; a file that is inconsistent with its header is rejected. */
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring> // std::memcmp
+#include <cstdio> // std::remove
+#include <cstdlib> // std::getenv
+
+#ifdef _WIN32
+// Keep windows.h from clashing with names used elsewhere in the project (e.g. Ellipse)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef NOGDI
+#define NOGDI
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "3.5_Flyweight.h"
+
+namespace mapped_flyweight {
+	const char Magic[8] = { 'F', 'L', 'Y', 'W', 'D', 'O', 'C', '\0' };
+	const std::uint32_t Version = 1;
+
+	struct Header {
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t fontSizeCount;
+		std::uint32_t fontNameCount;
+		std::uint32_t reserved;
+		std::uint64_t fontSizesOffset;
+		std::uint64_t fontNamesOffset;
+		std::uint64_t namesOffset;
+		std::uint64_t namesBytes;
+		std::uint64_t charactersOffset;
+		std::uint64_t characterCount;
+	};
+
+	struct NameEntry {
+		std::uint32_t offset;
+		std::uint32_t length;
+	};
+
+	inline std::uint64_t align8(std::uint64_t offset) {
+		return (offset + 7) & ~std::uint64_t(7);
+	}
+
+	// A path for name in the temporary directory, made unique to this process
+	inline std::string temporaryPath(const std::string& name) {
+#ifdef _WIN32
+		char directory[MAX_PATH + 1];
+		DWORD length = GetTempPathA(static_cast<DWORD>(sizeof(directory)), directory);
+		std::string path = length != 0 && length <= MAX_PATH ? std::string(directory, length) : std::string(".\\");
+		return path + std::to_string(GetCurrentProcessId()) + "_" + name;
+#else
+		const char* directory = std::getenv("TMPDIR");
+		std::string path = directory != nullptr && *directory != '\0' ? directory : "/tmp";
+		return path + "/" + std::to_string(getpid()) + "_" + name;
+#endif
+	}
+}
+
+// On-disk form of a FlyweightCharacter
+struct MappedCharacter {
+	std::uint16_t fontSizeIndex;
+	std::uint16_t fontNameIndex;
+	std::uint32_t positionInStream;
+};
+
+void writeFlyweightDocument(const std::string& path, const std::vector<float>& fontSizes,
+	const std::vector<std::string>& fontNames, const std::vector<FlyweightCharacter>& chars) {
+
+	using namespace mapped_flyweight;
+
+	std::vector<NameEntry> entries;
+	std::string names;
+	for (const std::string& name : fontNames) {
+		entries.push_back(NameEntry{ static_cast<std::uint32_t>(names.size()), static_cast<std::uint32_t>(name.size()) });
+		names += name;
+	}
+
+	Header header = {};
+	std::memcpy(header.magic, Magic, sizeof(Magic));
+	header.version = Version;
+	header.fontSizeCount = static_cast<std::uint32_t>(fontSizes.size());
+	header.fontNameCount = static_cast<std::uint32_t>(fontNames.size());
+	header.fontSizesOffset = align8(sizeof(Header));
+	header.fontNamesOffset = align8(header.fontSizesOffset + fontSizes.size() * sizeof(float));
+	header.namesOffset = align8(header.fontNamesOffset + entries.size() * sizeof(NameEntry));
+	header.namesBytes = names.size();
+	header.charactersOffset = align8(header.namesOffset + names.size());
+	header.characterCount = chars.size();
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out) {
+		throw std::runtime_error("Cannot create " + path);
+	}
+
+	auto writeAt = [&out](std::uint64_t offset, const void* data, size_t size) {
+		static const char padding[8] = {};
+		std::uint64_t position = static_cast<std::uint64_t>(out.tellp());
+		out.write(padding, static_cast<std::streamsize>(offset - position));
+		out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+	};
+
+	writeAt(0, &header, sizeof(header));
+	writeAt(header.fontSizesOffset, fontSizes.data(), fontSizes.size() * sizeof(float));
+	writeAt(header.fontNamesOffset, entries.data(), entries.size() * sizeof(NameEntry));
+	writeAt(header.namesOffset, names.data(), names.size());
+	writeAt(header.charactersOffset, nullptr, 0);
+
+	std::vector<MappedCharacter> block;
+	block.reserve(4096);
+	for (size_t i = 0; i < chars.size(); i += block.capacity()) {
+		block.clear();
+		for (size_t j = i; j < chars.size() && block.size() < block.capacity(); ++j) {
+			block.push_back(MappedCharacter{ chars[j].getFontSizeIndex(), chars[j].getFontNameIndex(), chars[j].getPositionInStream() });
+		}
+		out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(block.size() * sizeof(MappedCharacter)));
+	}
+
+	if (!out) {
+		throw std::runtime_error("Cannot write " + path);
+	}
+}
+
+class MappedFlyweightDocument {
+	const char* m_data;
+	std::uint64_t m_size;
+	const mapped_flyweight::Header* m_header;
+
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#endif
+
+	void check(bool condition, const std::string& path) {
+		if (!condition) {
+			unmap();
+			throw std::runtime_error(path + " is not a valid flyweight document");
+		}
+	}
+
+	void unmap() {
+		if (m_data == nullptr) {
+			return;
+		}
+#ifdef _WIN32
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mapping);
+		CloseHandle(m_file);
+#else
+		munmap(const_cast<char*>(m_data), static_cast<size_t>(m_size));
+#endif
+		m_data = nullptr;
+	}
+
+	// Does [offset, offset + count * size) lie within the file?
+	bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t size) const {
+		return offset % 8 == 0 && offset <= m_size && count <= (m_size - offset) / size;
+	}
+
+public:
+	explicit MappedFlyweightDocument(const std::string& path) : m_data(nullptr), m_size(0), m_header(nullptr) {
+#ifdef _WIN32
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER size;
+		if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+			if (m_file != INVALID_HANDLE_VALUE) {
+				CloseHandle(m_file);
+			}
+			throw std::runtime_error("Cannot open " + path);
+		}
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		const void* view = m_mapping != nullptr ? MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (view == nullptr) {
+			if (m_mapping != nullptr) {
+				CloseHandle(m_mapping);
+			}
+			CloseHandle(m_file);
+			throw std::runtime_error("Cannot map " + path);
+		}
+		m_size = static_cast<std::uint64_t>(size.QuadPart);
+		m_data = static_cast<const char*>(view);
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		struct stat info;
+		if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+			if (fd >= 0) {
+				::close(fd);
+			}
+			throw std::runtime_error("Cannot open " + path);
+		}
+		m_size = static_cast<std::uint64_t>(info.st_size);
+		void* view = mmap(nullptr, static_cast<size_t>(m_size), PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd); // the mapping keeps the file open
+		if (view == MAP_FAILED) {
+			throw std::runtime_error("Cannot map " + path);
+		}
+		m_data = static_cast<const char*>(view);
+#endif
+
+		using namespace mapped_flyweight;
+		check(m_size >= sizeof(Header), path);
+		m_header = reinterpret_cast<const Header*>(m_data);
+		check(std::memcmp(m_header->magic, Magic, sizeof(Magic)) == 0 && m_header->version == Version, path);
+		check(fits(m_header->fontSizesOffset, m_header->fontSizeCount, sizeof(float)), path);
+		check(fits(m_header->fontNamesOffset, m_header->fontNameCount, sizeof(NameEntry)), path);
+		check(m_header->namesOffset <= m_size && m_header->namesBytes <= m_size - m_header->namesOffset, path);
+		check(fits(m_header->charactersOffset, m_header->characterCount, sizeof(MappedCharacter)), path);
+
+		const NameEntry* names = reinterpret_cast<const NameEntry*>(m_data + m_header->fontNamesOffset);
+		for (std::uint32_t i = 0; i < m_header->fontNameCount; ++i) {
+			check(names[i].offset <= m_header->namesBytes && names[i].length <= m_header->namesBytes - names[i].offset, path);
+		}
+	}
+
+	~MappedFlyweightDocument() {
+		unmap();
+	}
+
+	MappedFlyweightDocument(const MappedFlyweightDocument&) = delete;
+	MappedFlyweightDocument& operator=(const MappedFlyweightDocument&) = delete;
+
+	std::uint32_t fontSizeCount() const {
+		return m_header->fontSizeCount;
+	}
+
+	std::uint32_t fontNameCount() const {
+		return m_header->fontNameCount;
+	}
+
+	std::uint64_t characterCount() const {
+		return m_header->characterCount;
+	}
+
+	float fontSize(std::uint32_t index) const {
+		if (index >= m_header->fontSizeCount) {
+			throw std::out_of_range("Font size index out of range");
+		}
+		return reinterpret_cast<const float*>(m_data + m_header->fontSizesOffset)[index];
+	}
+
+	// The name points straight into the mapping; it is not null terminated
+	const char* fontName(std::uint32_t index, std::uint32_t& length) const {
+		if (index >= m_header->fontNameCount) {
+			throw std::out_of_range("Font name index out of range");
+		}
+		const mapped_flyweight::NameEntry& entry = reinterpret_cast<const mapped_flyweight::NameEntry*>(m_data + m_header->fontNamesOffset)[index];
+		length = entry.length;
+		return m_data + m_header->namesOffset + entry.offset;
+	}
+
+	const MappedCharacter* characters() const {
+		return reinterpret_cast<const MappedCharacter*>(m_data + m_header->charactersOffset);
+	}
+
+	void print(std::uint64_t index) const {
+		if (index >= m_header->characterCount) {
+			throw std::out_of_range("Character index out of range");
+		}
+		const MappedCharacter& c = characters()[index];
+		std::uint32_t length = 0;
+		const char* name = fontName(c.fontNameIndex, length);
+		std::cout << "Font Size: " << fontSize(c.fontSizeIndex) << ", font Name: ";
+		std::cout.write(name, length);
+		std::cout << ", character stream position: " << c.positionInStream << std::endl;
+	}
+};
+
+void flyweight_mapped(const std::string& path = mapped_flyweight::temporaryPath("flyweight_document.fwd")) {
+	FlyweightCharacterAbstractBuilder::setFontsAndNames();
+
+	std::vector<FlyweightCharacter> chars;
+	for (unsigned i = 0; i < 3; ++i) {
+		chars.push_back(FlyweightCharacterAbstractBuilder::createFlyweightCharacter(0, 0, i));
+		chars.push_back(FlyweightCharacterAbstractBuilder::createFlyweightCharacter(1, 1, i + 3));
+		chars.push_back(FlyweightCharacterAbstractBuilder::createFlyweightCharacter(2, 2, i + 6));
+	}
+
+	try {
+		writeFlyweightDocument(path, FlyweightCharacterAbstractBuilder::fontSizes, FlyweightCharacterAbstractBuilder::fontNames, chars);
+
+		MappedFlyweightDocument document(path);
+		for (std::uint64_t i = 0; i < document.characterCount(); ++i) {
+			document.print(i);
+		}
+	}
+	catch (const std::exception& e) {
+		std::cout << e.what() << std::endl;
+	}
+
+	std::remove(path.c_str());
+}
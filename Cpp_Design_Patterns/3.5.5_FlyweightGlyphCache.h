@@ -0,0 +1,114 @@
+#pragma once
+
+/* A glyph cache keyed by flyweight font
+
+FlyweightCharacter::print() looks its font up in the shared tables and formats it
+again on every call, even though a document only ever uses a handful of fonts and
+characters. GlyphCache keeps the rendered result of each (font handle, character)
+pair so that rendering the same glyph again is a lookup:
+
+- glyphs are kept in a ShardedLruCache (see 3.6.3_ShardedLruCache.h), so it is
+  bounded, evicting the least recently used glyph once full, and safe to share
+  between rendering threads; glyphs are rendered outside its locks
+- glyphs are handed out as shared_ptr, so a glyph stays valid for a renderer
+  still using it after it has been evicted
+- hit and miss counters show how well it is doing
+
+Fonts are resolved through a FontPool (see 3.5.1_FlyweightFontPool.h) and the
+rendering itself is a function supplied by the caller. */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+
+#include "3.5.1_FlyweightFontPool.h"
+#include "3.5.2_FlyweightDocument.h"
+#include "3.6.3_ShardedLruCache.h"
+
+class GlyphCache {
+public:
+	using Glyph = std::shared_ptr<const std::string>;
+	using Renderer = std::function<std::string(const Font&, char)>;
+
+private:
+	using Key = std::uint64_t; // font handle in the high bits, character in the low byte
+
+	static const size_t ShardCount = 16;
+
+	const FontPool& m_pool;
+	Renderer m_render;
+	ShardedLruCache<Key, Glyph> m_cache;
+
+	static Key makeKey(FontHandle font, char c) {
+		return (static_cast<Key>(font) << 8) | static_cast<unsigned char>(c);
+	}
+
+public:
+	GlyphCache(const FontPool& pool, Renderer render, size_t capacity = 4096)
+		: m_pool(pool), m_render(render), m_cache(capacity, ShardCount) {}
+
+	GlyphCache(const GlyphCache&) = delete;
+	GlyphCache& operator=(const GlyphCache&) = delete;
+
+	Glyph get(FontHandle font, char c) {
+		return m_cache.get(makeKey(font, c), [this, font, c]() {
+			return std::make_shared<const std::string>(m_render(m_pool.get(font), c));
+		});
+	}
+
+	std::uint64_t getHits() const {
+		return m_cache.getHits();
+	}
+
+	std::uint64_t getMisses() const {
+		return m_cache.getMisses();
+	}
+
+	std::uint64_t getEvictions() const {
+		return m_cache.getEvictions();
+	}
+};
+
+void flyweight_glyph_cache() {
+	FontPool pool;
+	const FontHandle fonts[] = { pool.intern("first_font", 1.0f), pool.intern("second_font", 1.5f), pool.intern("third_font", 2.0f) };
+
+	FlyweightDocument document;
+	for (size_t i = 0; i < 3000; ++i) {
+		document.append(static_cast<char>('a' + i % 26), fonts[i / 100 % 3]);
+	}
+
+	// Formats like FlyweightCharacter::print(), minus the stream position
+	GlyphCache cache(pool, [](const Font& font, char c) {
+		std::ostringstream glyph;
+		glyph << "Font Size: " << font.size << ", font Name: " << font.name << ", character: " << c;
+		return glyph.str();
+	}, 256);
+
+	// Four threads render the whole document
+	std::vector<std::thread> renderers;
+	std::atomic<size_t> rendered(0);
+	for (int t = 0; t < 4; ++t) {
+		renderers.emplace_back([&]() {
+			size_t bytes = 0;
+			for (std::uint64_t position = 0; position < document.size(); ++position) {
+				FlyweightDocument::Character c = document.at(position);
+				bytes += cache.get(c.font, c.value)->size();
+			}
+			rendered += bytes;
+		});
+	}
+	for (std::thread& renderer : renderers) {
+		renderer.join();
+	}
+
+	std::cout << *cache.get(fonts[1], 'q') << std::endl;
+	std::cout << "Rendered " << rendered << " bytes of glyphs: " << cache.getHits() << " hits, "
+		<< cache.getMisses() << " misses, " << cache.getEvictions() << " evictions" << std::endl;
+}
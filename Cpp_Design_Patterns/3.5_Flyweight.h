@@ -39,7 +39,7 @@ public:
 		fontNames[2] = "third_font";
 	}
 
-	static FlyweightCharacter createFlyweightCharacter(unsigned short, unsigned short, unsigned short);
+	static FlyweightCharacter createFlyweightCharacter(unsigned short, unsigned short, unsigned);
 };
 
 std::vector<float> FlyweightCharacterAbstractBuilder::fontSizes(3);
@@ -54,9 +54,21 @@ class FlyweightCharacter {
 
 public:
 
-	FlyweightCharacter(unsigned short fontSizeIndex, unsigned short fontNameIndex, unsigned short positionInStream) :
+	FlyweightCharacter(unsigned short fontSizeIndex, unsigned short fontNameIndex, unsigned positionInStream) :
 		fontSizeIndex(fontSizeIndex), fontNameIndex(fontNameIndex), positionInStream(positionInStream) {}
 
+	unsigned short getFontSizeIndex() const {
+		return fontSizeIndex;
+	}
+
+	unsigned short getFontNameIndex() const {
+		return fontNameIndex;
+	}
+
+	unsigned getPositionInStream() const {
+		return positionInStream;
+	}
+
 	void print() {
 		std::cout << "Font Size: " << FlyweightCharacterAbstractBuilder::fontSizes[fontSizeIndex]
 			<< ", font Name: " << FlyweightCharacterAbstractBuilder::fontNames[fontNameIndex]
@@ -67,7 +79,7 @@ public:
 };
 
 FlyweightCharacter FlyweightCharacterAbstractBuilder::createFlyweightCharacter(
-	unsigned short fontSizeIndex, unsigned short fontNameIndex, unsigned short positionInStream) {
+	unsigned short fontSizeIndex, unsigned short fontNameIndex, unsigned positionInStream) {
 
 	FlyweightCharacter fc(fontSizeIndex, fontNameIndex, positionInStream);
 
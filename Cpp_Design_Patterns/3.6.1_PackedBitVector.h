@@ -0,0 +1,467 @@
+#pragma once
+
+/* A packed bit vector with an explicit reference proxy
+
+proxy() shows the trap in std::vector<bool>: operator[] returns a proxy object
+(std::vector<bool>::reference), so "auto b = vec[3]" silently keeps a reference
+into the vector instead of a bool. PackedBitVector avoids the trap by making the
+proxy explicit:
+
+- operator[] always returns a plain bool, so "auto b = bits[3]" is a bool and
+  "bits[3] = true" does not compile
+- bits are written with set()/reset()/flip(), or through ref(i), which returns a
+  BitReference proxy that is clearly a reference by name
+
+Bits are packed 64 to a word, so bulk operations work a word at a time:
+
+- &=, |= and ^= with another vector of the same size (AVX2 when available,
+  otherwise a plain loop the compiler vectorizes)
+- count() using the hardware popcount instruction where available
+- findFirst()/findNext() using count-trailing-zeros
+- rank(i), the number of set bits before i, and select(k), the position of the
+  k-th set bit (counting from 0), both backed by a small index of cumulative
+  counts per 512 bit block which is rebuilt lazily after a modification
+
+rank() and select() are const, and any number of threads may call them at once:
+the first one after a modification rebuilds the index under a lock while the others
+wait for it. Modifications must not run at the same time as anything else. */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <stdexcept>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <cstdint>
+#include <cstddef> // std::ptrdiff_t
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace bits {
+	inline unsigned popcount(std::uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+		return static_cast<unsigned>(__builtin_popcountll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+		return static_cast<unsigned>(__popcnt64(word));
+#else
+		word = word - ((word >> 1) & 0x5555555555555555ull);
+		word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+		word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return static_cast<unsigned>((word * 0x0101010101010101ull) >> 56);
+#endif
+	}
+
+	// Index of the lowest set bit; word must not be zero
+	inline unsigned countTrailingZeros(std::uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+		return static_cast<unsigned>(__builtin_ctzll(word));
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long index;
+		_BitScanForward64(&index, word);
+		return static_cast<unsigned>(index);
+#else
+		unsigned index = 0;
+		while ((word & 1) == 0) {
+			word >>= 1;
+			++index;
+		}
+		return index;
+#endif
+	}
+
+	// Position of the k-th set bit (from 0) of a word with more than k set bits
+	inline unsigned selectInWord(std::uint64_t word, unsigned k) {
+		for (unsigned i = 0; i < k; ++i) {
+			word &= word - 1; // clear the lowest set bit
+		}
+		return countTrailingZeros(word);
+	}
+}
+
+class PackedBitVector {
+	static const size_t WordBits = 64;
+	static const size_t WordsPerBlock = 8; // rank index granularity: 512 bits
+
+	std::vector<std::uint64_t> m_words;
+	size_t m_size;
+
+	// The rank index is a cache, so the const rank() and select() may rebuild it
+	mutable std::vector<size_t> m_blockRanks; // set bits before each block
+	mutable std::atomic<bool> m_rankValid; // published with release once m_blockRanks is built
+	mutable std::mutex m_rankMutex; // serialises rebuilding among concurrent readers
+
+	void requireSameSize(const PackedBitVector& other) const {
+		if (other.m_size != m_size) {
+			throw std::invalid_argument("PackedBitVector sizes differ");
+		}
+	}
+
+	size_t blockCount() const {
+		return (m_words.size() + WordsPerBlock - 1) / WordsPerBlock;
+	}
+
+	// m_blockRanks[b] is the number of set bits before block b; the extra last entry is the total
+	void buildRankIndex() const {
+		m_blockRanks.assign(blockCount() + 1, 0);
+		size_t total = 0;
+		for (size_t w = 0; w < m_words.size(); ++w) {
+			if (w % WordsPerBlock == 0) {
+				m_blockRanks[w / WordsPerBlock] = total;
+			}
+			total += bits::popcount(m_words[w]);
+		}
+		m_blockRanks.back() = total;
+	}
+
+	void requireRankIndex() const {
+		if (m_rankValid.load(std::memory_order_acquire)) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_rankMutex);
+		if (!m_rankValid.load(std::memory_order_relaxed)) {
+			buildRankIndex();
+			m_rankValid.store(true, std::memory_order_release);
+		}
+	}
+
+	void invalidateRankIndex() {
+		m_rankValid.store(false, std::memory_order_relaxed);
+	}
+
+	// Apply op to every word, four words at a time with AVX2 when available
+	template <typename WordOp>
+	void combine(const PackedBitVector& other, WordOp op) {
+		requireSameSize(other);
+		std::uint64_t* a = m_words.data();
+		const std::uint64_t* b = other.m_words.data();
+		size_t w = 0;
+#if defined(__AVX2__)
+		for (; w + 4 <= m_words.size(); w += 4) {
+			__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + w));
+			__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + w));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(a + w), op(x, y));
+		}
+#endif
+		for (; w < m_words.size(); ++w) {
+			a[w] = op(a[w], b[w]);
+		}
+		invalidateRankIndex();
+	}
+
+	struct And {
+		std::uint64_t operator()(std::uint64_t x, std::uint64_t y) const { return x & y; }
+#if defined(__AVX2__)
+		__m256i operator()(__m256i x, __m256i y) const { return _mm256_and_si256(x, y); }
+#endif
+	};
+
+	struct Or {
+		std::uint64_t operator()(std::uint64_t x, std::uint64_t y) const { return x | y; }
+#if defined(__AVX2__)
+		__m256i operator()(__m256i x, __m256i y) const { return _mm256_or_si256(x, y); }
+#endif
+	};
+
+	struct Xor {
+		std::uint64_t operator()(std::uint64_t x, std::uint64_t y) const { return x ^ y; }
+#if defined(__AVX2__)
+		__m256i operator()(__m256i x, __m256i y) const { return _mm256_xor_si256(x, y); }
+#endif
+	};
+
+public:
+	// A reference to one bit. Unlike std::vector<bool>::reference it is only ever
+	// obtained by asking for it by name, through ref().
+	class BitReference {
+		PackedBitVector& m_bits;
+		size_t m_index;
+
+	public:
+		BitReference(PackedBitVector& bits, size_t index) : m_bits(bits), m_index(index) {}
+
+		BitReference& operator=(bool value) {
+			m_bits.set(m_index, value);
+			return *this;
+		}
+
+		BitReference& operator=(const BitReference& other) {
+			m_bits.set(m_index, static_cast<bool>(other));
+			return *this;
+		}
+
+		operator bool() const {
+			return m_bits.test(m_index);
+		}
+
+		void flip() {
+			m_bits.flip(m_index);
+		}
+	};
+
+	explicit PackedBitVector(size_t size = 0, bool value = false)
+		: m_words((size + WordBits - 1) / WordBits, value ? ~std::uint64_t(0) : 0), m_size(size), m_rankValid(false) {
+		if (value && size % WordBits != 0) {
+			m_words.back() &= (std::uint64_t(1) << (size % WordBits)) - 1; // keep unused bits clear
+		}
+	}
+
+	// Copies and moves take the bits only; the rank index is rebuilt when next needed
+	PackedBitVector(const PackedBitVector& other) : m_words(other.m_words), m_size(other.m_size), m_rankValid(false) {}
+
+	PackedBitVector(PackedBitVector&& other) noexcept : m_words(std::move(other.m_words)), m_size(other.m_size), m_rankValid(false) {
+		other.m_words.clear();
+		other.m_size = 0;
+		other.invalidateRankIndex();
+	}
+
+	PackedBitVector& operator=(const PackedBitVector& other) {
+		if (this != &other) {
+			m_words = other.m_words;
+			m_size = other.m_size;
+			invalidateRankIndex();
+		}
+		return *this;
+	}
+
+	PackedBitVector& operator=(PackedBitVector&& other) noexcept {
+		if (this != &other) {
+			m_words = std::move(other.m_words);
+			m_size = other.m_size;
+			invalidateRankIndex();
+			other.m_words.clear();
+			other.m_size = 0;
+			other.invalidateRankIndex();
+		}
+		return *this;
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	bool test(size_t i) const {
+		return (m_words[i / WordBits] >> (i % WordBits)) & 1;
+	}
+
+	bool operator[](size_t i) const {
+		return test(i);
+	}
+
+	bool at(size_t i) const {
+		if (i >= m_size) {
+			throw std::out_of_range("PackedBitVector index out of range");
+		}
+		return test(i);
+	}
+
+	void set(size_t i, bool value = true) {
+		std::uint64_t mask = std::uint64_t(1) << (i % WordBits);
+		if (value) {
+			m_words[i / WordBits] |= mask;
+		}
+		else {
+			m_words[i / WordBits] &= ~mask;
+		}
+		invalidateRankIndex();
+	}
+
+	void reset(size_t i) {
+		set(i, false);
+	}
+
+	void flip(size_t i) {
+		m_words[i / WordBits] ^= std::uint64_t(1) << (i % WordBits);
+		invalidateRankIndex();
+	}
+
+	BitReference ref(size_t i) {
+		return BitReference(*this, i);
+	}
+
+	PackedBitVector& operator&=(const PackedBitVector& other) {
+		combine(other, And());
+		return *this;
+	}
+
+	PackedBitVector& operator|=(const PackedBitVector& other) {
+		combine(other, Or());
+		return *this;
+	}
+
+	PackedBitVector& operator^=(const PackedBitVector& other) {
+		combine(other, Xor());
+		return *this;
+	}
+
+	size_t count() const {
+		size_t total = 0;
+		for (std::uint64_t word : m_words) {
+			total += bits::popcount(word);
+		}
+		return total;
+	}
+
+	// Position of the first set bit at or after from, or size() if there is none
+	size_t findNext(size_t from) const {
+		if (from >= m_size) {
+			return m_size;
+		}
+		size_t w = from / WordBits;
+		std::uint64_t word = m_words[w] & (~std::uint64_t(0) << (from % WordBits));
+		while (word == 0) {
+			if (++w == m_words.size()) {
+				return m_size;
+			}
+			word = m_words[w];
+		}
+		return w * WordBits + bits::countTrailingZeros(word);
+	}
+
+	size_t findFirst() const {
+		return findNext(0);
+	}
+
+	// Number of set bits in [0, i)
+	size_t rank(size_t i) const {
+		requireRankIndex();
+		if (i >= m_size) {
+			return m_blockRanks.back();
+		}
+		size_t w = i / WordBits;
+		size_t block = w / WordsPerBlock;
+		size_t total = m_blockRanks[block] + countFrom(block * WordsPerBlock, w);
+		size_t offset = i % WordBits;
+		if (offset != 0) {
+			total += bits::popcount(m_words[w] & ((std::uint64_t(1) << offset) - 1));
+		}
+		return total;
+	}
+
+	// Position of the k-th set bit (from 0), or size() if fewer than k + 1 bits are set
+	size_t select(size_t k) const {
+		requireRankIndex();
+		size_t blocks = blockCount();
+		if (blocks == 0) {
+			return m_size;
+		}
+		// Last block with fewer than k + 1 bits set before it
+		size_t block = static_cast<size_t>(std::upper_bound(m_blockRanks.begin(), m_blockRanks.begin() + static_cast<std::ptrdiff_t>(blocks), k)
+			- m_blockRanks.begin()) - 1;
+		size_t remaining = k - m_blockRanks[block];
+		for (size_t w = block * WordsPerBlock; w < m_words.size(); ++w) {
+			size_t inWord = bits::popcount(m_words[w]);
+			if (remaining < inWord) {
+				return w * WordBits + bits::selectInWord(m_words[w], static_cast<unsigned>(remaining));
+			}
+			remaining -= inWord;
+		}
+		return m_size;
+	}
+
+private:
+	size_t countFrom(size_t firstWord, size_t lastWord) const {
+		size_t total = 0;
+		for (size_t w = firstWord; w < lastWord; ++w) {
+			total += bits::popcount(m_words[w]);
+		}
+		return total;
+	}
+};
+
+void proxy_bit_vector() {
+	PackedBitVector vec(5);
+	vec.set(0);
+	vec.set(2);
+	vec.set(3);
+
+	auto b1 = vec[3]; // a plain bool, not a proxy
+	PackedBitVector::BitReference b2 = vec.ref(4); // a proxy, and obviously so
+	b2 = true;
+
+	std::cout << "b1 = " << b1 << ", bit 4 = " << vec[4] << ", " << vec.count() << " bits set, first at "
+		<< vec.findFirst() << ", rank(4) = " << vec.rank(4) << ", select(2) = " << vec.select(2) << std::endl;
+}
+
+// Bulk operations on n bits, against std::vector<bool>
+void proxy_bit_vector_benchmark(size_t n = 1000000000) {
+	std::mt19937_64 random(7);
+	std::vector<bool> va(n), vb(n);
+	PackedBitVector pa(n), pb(n);
+	for (size_t i = 0; i < n; i += 64) {
+		std::uint64_t x = random(), y = random();
+		for (size_t j = 0; j < 64 && i + j < n; ++j) {
+			bool bx = (x >> j) & 1, by = (y >> j) & 1;
+			va[i + j] = bx;
+			vb[i + j] = by;
+			pa.set(i + j, bx);
+			pb.set(i + j, by);
+		}
+	}
+
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) {
+		return std::chrono::duration<double, std::milli>(d).count();
+	};
+	volatile size_t sink = 0;
+
+	auto start = Clock::now();
+	for (size_t i = 0; i < n; ++i) {
+		va[i] = va[i] != vb[i];
+	}
+	auto vectorXor = Clock::now() - start;
+	start = Clock::now();
+	pa ^= pb;
+	auto packedXor = Clock::now() - start;
+
+	start = Clock::now();
+	sink = static_cast<size_t>(std::count(va.begin(), va.end(), true));
+	auto vectorCount = Clock::now() - start;
+	start = Clock::now();
+	sink = pa.count();
+	auto packedCount = Clock::now() - start;
+
+	// Clear everything but the last bit, so finding the first set bit scans it all
+	std::vector<bool> sparse(n);
+	sparse[n - 1] = true;
+	PackedBitVector packedSparse(n);
+	packedSparse.set(n - 1);
+
+	start = Clock::now();
+	sink = static_cast<size_t>(std::find(sparse.begin(), sparse.end(), true) - sparse.begin());
+	auto vectorFind = Clock::now() - start;
+	start = Clock::now();
+	sink = packedSparse.findFirst();
+	auto packedFind = Clock::now() - start;
+
+	// rank(i) over std::vector<bool> is a count of the prefix
+	const size_t queries = 10;
+	start = Clock::now();
+	for (size_t q = 0; q < queries; ++q) {
+		sink = static_cast<size_t>(std::count(va.begin(), va.begin() + static_cast<std::ptrdiff_t>(random() % n), true));
+	}
+	auto vectorRank = Clock::now() - start;
+	start = Clock::now();
+	pa.rank(0); // build the index
+	auto packedIndex = Clock::now() - start;
+	start = Clock::now();
+	for (size_t q = 0; q < queries; ++q) {
+		sink = pa.rank(static_cast<size_t>(random() % n));
+	}
+	auto packedRank = Clock::now() - start;
+	(void)sink;
+
+	std::cout << n << " bits, std::vector<bool> vs PackedBitVector (ms):" << std::endl
+		<< "  xor:        " << ms(vectorXor) << " vs " << ms(packedXor) << std::endl
+		<< "  popcount:   " << ms(vectorCount) << " vs " << ms(packedCount) << std::endl
+		<< "  find first: " << ms(vectorFind) << " vs " << ms(packedFind) << std::endl
+		<< "  " << queries << " ranks:   " << ms(vectorRank) << " vs " << ms(packedRank)
+		<< " (plus " << ms(packedIndex) << " to build the rank index once)" << std::endl;
+}
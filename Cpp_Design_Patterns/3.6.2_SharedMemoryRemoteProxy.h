@@ -0,0 +1,403 @@
+#pragma once
+
+/* Remote proxy over shared memory
+
+A remote proxy represents a subject that lives in another address space. Here the
+subject runs in a worker process on the same host, so a component that may crash
+only takes its own process down, while calls avoid the cost of sockets:
+
+- the proxy forks the worker, which creates the real subject and serves requests
+- requests and responses travel through two single-producer/single-consumer ring
+  buffers in a shared memory mapping
+- crunchBatch() pipelines: it keeps the request ring full while draining
+  responses, and the worker answers requests in batches
+- an idle side sleeps on a futex and is only woken when the other side sees it
+  waiting, so a busy pipeline makes no system calls at all
+- if the worker dies, calls on the proxy throw instead of hanging
+
+The shared memory and futex parts need POSIX (futexes are Linux only; elsewhere an
+idle side polls with short sleeps). On other platforms the demo says so and returns. */
+
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define REMOTE_PROXY_SUPPORTED 1
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <new> // placement new
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#endif
+#endif
+
+// The subject interface
+class NumberCruncher {
+public:
+	virtual ~NumberCruncher() {}
+	virtual std::int64_t crunch(std::int64_t value) = 0;
+};
+
+class LocalCruncher : public NumberCruncher {
+public:
+	std::int64_t crunch(std::int64_t value) override {
+		return value * value + 1;
+	}
+};
+
+#ifdef REMOTE_PROXY_SUPPORTED
+
+namespace shared_memory {
+	// Sleep while *word == expected, for at most timeout
+	inline void wait(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::microseconds timeout) {
+#if defined(__linux__)
+		timespec ts;
+		ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000);
+		ts.tv_nsec = static_cast<long>(timeout.count() % 1000000 * 1000);
+		// Not FUTEX_PRIVATE: the word is shared between processes
+		syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+		if (word.load() == expected) {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+#endif
+	}
+
+	inline void wake(std::atomic<std::uint32_t>& word) {
+#if defined(__linux__)
+		syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+#else
+		(void)word;
+#endif
+	}
+
+	/* A single-producer/single-consumer ring placed in shared memory. head and tail
+	only ever increase; the waiting flags tell the other side a wake is needed. */
+	template <typename T, std::uint32_t Capacity>
+	struct Ring {
+		static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+		static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "futex needs a plain 32 bit word");
+
+		alignas(64) std::atomic<std::uint32_t> head;            // written by the producer
+		alignas(64) std::atomic<std::uint32_t> tail;            // written by the consumer
+		alignas(64) std::atomic<std::uint32_t> consumerWaiting;
+		std::atomic<std::uint32_t> producerWaiting;
+		T slots[Capacity];
+
+		Ring() : head(0), tail(0), consumerWaiting(0), producerWaiting(0) {}
+
+		bool tryPush(const T& value) {
+			std::uint32_t h = head.load(std::memory_order_relaxed);
+			if (h - tail.load(std::memory_order_acquire) == Capacity) {
+				return false;
+			}
+			slots[h % Capacity] = value;
+			head.store(h + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool tryPop(T& value) {
+			std::uint32_t t = tail.load(std::memory_order_relaxed);
+			if (head.load(std::memory_order_acquire) == t) {
+				return false;
+			}
+			value = slots[t % Capacity];
+			tail.store(t + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Called by the producer after pushing a batch
+		void notifyConsumer() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (consumerWaiting.load(std::memory_order_relaxed) != 0) {
+				wake(head);
+			}
+		}
+
+		// Called by the consumer after popping a batch
+		void notifyProducer() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (producerWaiting.load(std::memory_order_relaxed) != 0) {
+				wake(tail);
+			}
+		}
+
+		// Consumer: spin briefly, then sleep until something is pushed or timeout
+		void waitForData(std::chrono::microseconds timeout) {
+			std::uint32_t t = tail.load(std::memory_order_relaxed);
+			for (int spin = 0; spin < 1000; ++spin) {
+				if (head.load(std::memory_order_acquire) != t) {
+					return;
+				}
+			}
+			consumerWaiting.store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			std::uint32_t h = head.load(std::memory_order_relaxed);
+			if (h == t) {
+				shared_memory::wait(head, h, timeout);
+			}
+			consumerWaiting.store(0, std::memory_order_relaxed);
+		}
+
+		// Producer: spin briefly, then sleep until something is popped or timeout
+		void waitForSpace(std::chrono::microseconds timeout) {
+			std::uint32_t h = head.load(std::memory_order_relaxed);
+			for (int spin = 0; spin < 1000; ++spin) {
+				if (h - tail.load(std::memory_order_acquire) != Capacity) {
+					return;
+				}
+			}
+			producerWaiting.store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			std::uint32_t t = tail.load(std::memory_order_relaxed);
+			if (h - t == Capacity) {
+				shared_memory::wait(tail, t, timeout);
+			}
+			producerWaiting.store(0, std::memory_order_relaxed);
+		}
+	};
+}
+
+class SharedMemoryCruncherProxy : public NumberCruncher {
+	enum Operation : std::int32_t { Crunch, Shutdown };
+
+	struct Request {
+		std::uint64_t id;
+		std::int64_t argument;
+		std::int32_t operation;
+	};
+
+	struct Response {
+		std::uint64_t id;
+		std::int64_t result;
+	};
+
+	static const std::uint32_t RingSize = 1024;
+
+	struct Channel {
+		shared_memory::Ring<Request, RingSize> requests;
+		shared_memory::Ring<Response, RingSize> responses;
+	};
+
+	Channel* m_channel;
+	pid_t m_worker;
+	bool m_workerAlive;
+	std::uint64_t m_nextId;
+
+	// Longest a waiting side sleeps before checking again that the other is alive
+	static std::chrono::microseconds waitSlice() {
+		return std::chrono::microseconds(10000);
+	}
+
+	// Runs in the worker process until told to shut down
+	static void serve(Channel& channel, NumberCruncher& subject) {
+		Request request;
+		for (;;) {
+			bool any = false;
+			while (channel.requests.tryPop(request)) {
+				any = true;
+				if (request.operation == Shutdown) {
+					return;
+				}
+				Response response{ request.id, subject.crunch(request.argument) };
+				while (!channel.responses.tryPush(response)) {
+					channel.responses.notifyConsumer();
+					channel.requests.notifyProducer();
+					channel.responses.waitForSpace(waitSlice());
+				}
+			}
+			if (any) {
+				channel.requests.notifyProducer();
+				channel.responses.notifyConsumer();
+			}
+			else {
+				channel.requests.waitForData(waitSlice());
+			}
+		}
+	}
+
+	void checkWorker() {
+		int status = 0;
+		if (m_workerAlive && waitpid(m_worker, &status, WNOHANG) == m_worker) {
+			m_workerAlive = false;
+		}
+		if (!m_workerAlive) {
+			throw std::runtime_error("The cruncher worker process has died");
+		}
+	}
+
+public:
+	// The subject is created by the factory inside the worker process
+	explicit SharedMemoryCruncherProxy(std::function<std::unique_ptr<NumberCruncher>()> makeSubject)
+		: m_channel(nullptr), m_worker(-1), m_workerAlive(false), m_nextId(0) {
+		void* memory = mmap(nullptr, sizeof(Channel), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) {
+			throw std::runtime_error("Cannot map shared memory");
+		}
+		m_channel = new (memory) Channel();
+
+		std::cout.flush(); // don't let the worker inherit pending output
+		m_worker = fork();
+		if (m_worker < 0) {
+			munmap(memory, sizeof(Channel));
+			throw std::runtime_error("Cannot start the cruncher worker process");
+		}
+		if (m_worker == 0) {
+			// The worker must never unwind into the copy of the parent's stack it was forked with
+			int status = 0;
+			try {
+				std::unique_ptr<NumberCruncher> subject = makeSubject();
+				serve(*m_channel, *subject);
+			}
+			catch (...) {
+				status = 1;
+			}
+			_exit(status);
+		}
+		m_workerAlive = true;
+	}
+
+	~SharedMemoryCruncherProxy() {
+		if (m_workerAlive) {
+			Request shutdown{ m_nextId++, 0, Shutdown };
+			bool exited = false;
+			while (!exited && !m_channel->requests.tryPush(shutdown)) {
+				m_channel->requests.waitForSpace(waitSlice());
+				exited = waitpid(m_worker, nullptr, WNOHANG) == m_worker;
+			}
+			if (!exited) {
+				m_channel->requests.notifyConsumer();
+				waitpid(m_worker, nullptr, 0);
+			}
+		}
+		m_channel->~Channel();
+		munmap(m_channel, sizeof(Channel));
+	}
+
+	SharedMemoryCruncherProxy(const SharedMemoryCruncherProxy&) = delete;
+	SharedMemoryCruncherProxy& operator=(const SharedMemoryCruncherProxy&) = delete;
+
+	std::int64_t crunch(std::int64_t value) override {
+		return crunchBatch(std::vector<std::int64_t>(1, value))[0];
+	}
+
+	// Keep the request ring full while collecting responses as they arrive
+	std::vector<std::int64_t> crunchBatch(const std::vector<std::int64_t>& values) {
+		checkWorker();
+
+		std::vector<std::int64_t> results(values.size());
+		const std::uint64_t firstId = m_nextId;
+		size_t sent = 0, received = 0;
+
+		while (received < values.size()) {
+			size_t pushed = 0;
+			while (sent < values.size() && m_channel->requests.tryPush(Request{ firstId + sent, values[sent], Crunch })) {
+				++sent;
+				++pushed;
+			}
+			if (pushed != 0) {
+				m_channel->requests.notifyConsumer();
+			}
+
+			size_t popped = 0;
+			Response response;
+			while (m_channel->responses.tryPop(response)) {
+				results[static_cast<size_t>(response.id - firstId)] = response.result;
+				++received;
+				++popped;
+			}
+			if (popped != 0) {
+				m_channel->responses.notifyProducer();
+			}
+
+			if (pushed == 0 && popped == 0) {
+				m_channel->responses.waitForData(waitSlice());
+				checkWorker();
+			}
+		}
+
+		m_nextId = firstId + values.size();
+		return results;
+	}
+};
+
+// A subject that crashes on negative input, taking only the worker down with it
+class FragileCruncher : public NumberCruncher {
+public:
+	std::int64_t crunch(std::int64_t value) override {
+		if (value < 0) {
+			_exit(3); // simulated crash
+		}
+		return value * value + 1;
+	}
+};
+
+void proxy_remote() {
+	{
+		SharedMemoryCruncherProxy remote([]() { return std::make_unique<FragileCruncher>(); });
+		NumberCruncher& cruncher = remote;
+		std::cout << "Remote crunch(12) = " << cruncher.crunch(12) << std::endl;
+
+		try {
+			cruncher.crunch(-1);
+		}
+		catch (const std::runtime_error& e) {
+			std::cout << "crunch(-1) failed: " << e.what() << ", but this process carries on" << std::endl;
+		}
+	}
+}
+
+// Round-trip latency of single calls and throughput of pipelined batches
+void proxy_remote_benchmark(unsigned calls = 100000, size_t batch = 1000000) {
+	SharedMemoryCruncherProxy remote([]() { return std::make_unique<LocalCruncher>(); });
+	LocalCruncher local;
+	volatile std::int64_t sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned i = 0; i < calls; ++i) {
+		sink = remote.crunch(i);
+	}
+	auto roundTrips = std::chrono::steady_clock::now() - start;
+
+	std::vector<std::int64_t> values(batch);
+	for (size_t i = 0; i < batch; ++i) {
+		values[i] = static_cast<std::int64_t>(i);
+	}
+	start = std::chrono::steady_clock::now();
+	std::vector<std::int64_t> results = remote.crunchBatch(values);
+	auto pipelined = std::chrono::steady_clock::now() - start;
+
+	bool correct = true;
+	for (size_t i = 0; i < batch; ++i) {
+		correct = correct && results[i] == local.crunch(values[i]);
+	}
+	(void)sink;
+
+	double seconds = std::chrono::duration<double>(pipelined).count();
+	std::cout << "Shared memory remote proxy:" << std::endl
+		<< "  round trip: " << std::chrono::duration<double, std::micro>(roundTrips).count() / calls << " us per call" << std::endl
+		<< "  pipelined:  " << static_cast<double>(batch) / (seconds > 0.0 ? seconds : 1e-9) / 1e6 << " million calls/s"
+		<< (correct ? "" : " (WRONG RESULTS)") << std::endl;
+}
+
+#else
+
+void proxy_remote() {
+	std::cout << "The shared memory remote proxy needs a POSIX system" << std::endl;
+}
+
+void proxy_remote_benchmark() {
+	proxy_remote();
+}
+
+#endif
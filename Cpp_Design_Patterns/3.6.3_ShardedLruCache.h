@@ -0,0 +1,155 @@
+#pragma once
+
+/* A sharded LRU cache
+
+The bounded, thread safe cache behind the caching proxy (see 3.6_Proxy.h) and the
+glyph cache (see 3.5.5_FlyweightGlyphCache.h). ShardedLruCache<Key, Value, Hash>
+maps keys to values made on demand by the caller:
+
+- it is bounded; once a shard is full, its least recently used value is evicted
+- values can optionally expire after a time-to-live
+- lookups from many threads are spread over shards, each an LRU list with its own
+  mutex. A missing value is made outside the lock, so a slow one does not hold up
+  lookups of other keys; two threads missing on the same key may both make it, and
+  the first one stored is kept
+- hit, miss, eviction and expiry counters report how well the cache is doing
+
+Values are returned by copy, so a value handed out stays valid after it has been
+evicted; make Value a shared_ptr when copying it would be expensive. */
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <cstdint>
+
+template <typename Key, typename Value, typename Hash = std::hash<Key> >
+class ShardedLruCache {
+public:
+	using Clock = std::chrono::steady_clock;
+
+private:
+	struct Entry {
+		Key key;
+		Value value;
+		Clock::time_point expires;
+	};
+
+	struct Shard {
+		std::mutex mutex;
+		std::list<Entry> lru; // most recently used first
+		std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+	};
+
+	std::vector<std::unique_ptr<Shard> > m_shards;
+	size_t m_shardCapacity;
+	Clock::duration m_ttl;
+	Hash m_hash;
+
+	std::atomic<std::uint64_t> m_hits;
+	std::atomic<std::uint64_t> m_misses;
+	std::atomic<std::uint64_t> m_evictions;
+	std::atomic<std::uint64_t> m_expirations;
+
+	static size_t shardCapacity(size_t capacity, size_t shards) {
+		if (shards == 0) {
+			throw std::invalid_argument("A sharded cache needs at least one shard");
+		}
+		return std::max<size_t>(1, (capacity + shards - 1) / shards);
+	}
+
+	// Fibonacci hashing spreads neighbouring keys over the shards, even when the hash
+	// of a key is the key itself
+	Shard& shardOf(const Key& key) {
+		std::uint64_t h = static_cast<std::uint64_t>(m_hash(key)) * 0x9E3779B97F4A7C15ull;
+		return *m_shards[static_cast<size_t>(h >> 32) % m_shards.size()];
+	}
+
+	bool expired(const Entry& entry) const {
+		return m_ttl != Clock::duration::zero() && Clock::now() >= entry.expires;
+	}
+
+public:
+	// A ttl of zero means values never expire
+	ShardedLruCache(size_t capacity, size_t shards, Clock::duration ttl = Clock::duration::zero(), const Hash& hash = Hash())
+		: m_shardCapacity(shardCapacity(capacity, shards)), m_ttl(ttl), m_hash(hash),
+		m_hits(0), m_misses(0), m_evictions(0), m_expirations(0) {
+		for (size_t i = 0; i < shards; ++i) {
+			m_shards.push_back(std::make_unique<Shard>());
+		}
+	}
+
+	ShardedLruCache(const ShardedLruCache&) = delete;
+	ShardedLruCache& operator=(const ShardedLruCache&) = delete;
+
+	// The value cached for key or, if there is none, the one make() returns, which is
+	// cached. make() is called without holding any lock.
+	template <typename Make>
+	Value get(const Key& key, Make&& make) {
+		Shard& shard = shardOf(key);
+
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto it = shard.index.find(key);
+			if (it != shard.index.end()) {
+				if (!expired(*it->second)) {
+					shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+					m_hits.fetch_add(1, std::memory_order_relaxed);
+					return it->second->value;
+				}
+				shard.lru.erase(it->second);
+				shard.index.erase(it);
+				m_expirations.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		m_misses.fetch_add(1, std::memory_order_relaxed);
+		Value value = make();
+
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.index.find(key);
+		if (it != shard.index.end() && !expired(*it->second)) {
+			// Another thread got there first; everyone shares its value
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			return it->second->value;
+		}
+		if (it != shard.index.end()) {
+			shard.lru.erase(it->second);
+			shard.index.erase(it);
+		}
+		Clock::time_point expires = m_ttl == Clock::duration::zero() ? Clock::time_point() : Clock::now() + m_ttl;
+		shard.lru.push_front(Entry{ key, value, expires });
+		shard.index.emplace(key, shard.lru.begin());
+		if (shard.lru.size() > m_shardCapacity) {
+			shard.index.erase(shard.lru.back().key);
+			shard.lru.pop_back();
+			m_evictions.fetch_add(1, std::memory_order_relaxed);
+		}
+		return value;
+	}
+
+	void clear() {
+		for (std::unique_ptr<Shard>& shard : m_shards) {
+			std::lock_guard<std::mutex> lock(shard->mutex);
+			shard->index.clear();
+			shard->lru.clear();
+		}
+	}
+
+	std::uint64_t getHits() const { return m_hits.load(std::memory_order_relaxed); }
+	std::uint64_t getMisses() const { return m_misses.load(std::memory_order_relaxed); }
+	std::uint64_t getEvictions() const { return m_evictions.load(std::memory_order_relaxed); }
+	std::uint64_t getExpirations() const { return m_expirations.load(std::memory_order_relaxed); }
+
+	double getHitRate() const {
+		std::uint64_t hits = getHits(), total = hits + getMisses();
+		return total == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(total);
+	}
+};
@@ -12,12 +12,25 @@ object is called the 
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <tuple>
+#include <utility> // std::index_sequence
+#include <type_traits>
+#include <cstdint>
 
-void my_func(bool b) { /* Do work */ }
+#include "3.6.3_ShardedLruCache.h"
 
-int proxy() {
+void my_func(bool) { /* Do work */ }
 
-	std::vector<bool> vec = { 1, 2, 3, 4, 5 };
+void proxy() {
+
+	std::vector<bool> vec = { true, false, true, true, false };
 
 	bool b1 = vec[3]; 
 	my_func(b1); // fine
@@ -29,4 +42,210 @@ int proxy() {
 	// This makes it obvious we are deliberately creating a variable
 	// of a type different from that generated by the initialising expression
 	auto b3 = static_cast<bool>(vec[3]);
+	my_func(b3);
+}
+
+/* Virtual proxy
+
+A virtual proxy stands in for a subject that is expensive to create, and only
+creates it the first time it is actually used. LazyProxy<Subject> does this for
+any subject, given a factory function:
+
+- the subject is created on first access through -> or *, on the calling thread
+- prefetch() starts creating it early on a background thread, for callers that
+  know it will probably be needed; the first access then only waits for the rest
+- the time the first access spent blocked waiting for the subject is recorded,
+  which shows whether prefetching is paying off
+- an exception thrown by the factory is rethrown on every access
+
+Accessing the proxy from several threads is safe; all of them get the same subject. */
+template <class Subject>
+class LazyProxy {
+	std::function<std::unique_ptr<Subject>()> m_factory;
+	std::shared_future<std::shared_ptr<Subject> > m_subject;
+	std::once_flag m_firstAccess;
+	std::chrono::steady_clock::duration m_blocked;
+	mutable std::mutex m_mutex;
+
+	// Start creating the subject with the given launch policy, unless already started
+	std::shared_future<std::shared_ptr<Subject> > start(std::launch policy) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_subject.valid()) {
+			std::function<std::unique_ptr<Subject>()> factory = m_factory;
+			m_subject = std::async(policy, [factory]() {
+				return std::shared_ptr<Subject>(factory());
+			}).share();
+		}
+		return m_subject;
+	}
+
+	Subject& subject() {
+		std::shared_future<std::shared_ptr<Subject> > subject = start(std::launch::deferred);
+		std::call_once(m_firstAccess, [&]() {
+			auto begin = std::chrono::steady_clock::now();
+			subject.wait();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_blocked = std::chrono::steady_clock::now() - begin;
+		});
+		return *subject.get();
+	}
+
+public:
+	explicit LazyProxy(std::function<std::unique_ptr<Subject>()> factory)
+		: m_factory(factory), m_blocked(std::chrono::steady_clock::duration::zero()) {}
+
+	LazyProxy(const LazyProxy&) = delete;
+	LazyProxy& operator=(const LazyProxy&) = delete;
+
+	// Begin creating the subject in the background
+	void prefetch() {
+		start(std::launch::async);
+	}
+
+	bool isLoaded() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_subject.valid() && m_subject.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	// How long the first access waited for the subject to be created
+	std::chrono::steady_clock::duration getBlockedTime() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_blocked;
+	}
+
+	Subject* operator->() {
+		return &subject();
+	}
+
+	Subject& operator*() {
+		return subject();
+	}
+};
+
+// An expensive subject
+class HighResolutionImage {
+	std::string m_fileName;
+
+public:
+	explicit HighResolutionImage(const std::string& fileName) : m_fileName(fileName) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(100)); // pretend to load from disk
+		std::cout << "Loaded " << m_fileName << std::endl;
+	}
+
+	void display() const {
+		std::cout << "Displaying " << m_fileName << std::endl;
+	}
+};
+
+void proxy_lazy() {
+	LazyProxy<HighResolutionImage> onDemand([]() { return std::make_unique<HighResolutionImage>("photo1.png"); });
+	LazyProxy<HighResolutionImage> prefetched([]() { return std::make_unique<HighResolutionImage>("photo2.png"); });
+	LazyProxy<HighResolutionImage> unused([]() { return std::make_unique<HighResolutionImage>("photo3.png"); });
+
+	prefetched.prefetch();
+	std::this_thread::sleep_for(std::chrono::milliseconds(150)); // meanwhile, do other work
+
+	onDemand->display();
+	prefetched->display();
+
+	using std::chrono::duration_cast;
+	using std::chrono::milliseconds;
+	std::cout << "First access blocked for " << duration_cast<milliseconds>(onDemand.getBlockedTime()).count()
+		<< " ms on demand and " << duration_cast<milliseconds>(prefetched.getBlockedTime()).count()
+		<< " ms prefetched; photo3.png was " << (unused.isLoaded() ? "" : "never ") << "loaded" << std::endl;
+}
+
+/* Caching proxy
+
+A caching proxy sits in front of an expensive, pure operation and remembers its
+results, so repeated calls with the same arguments are answered without calling
+the real subject. CachingProxy<Result(Args...)> wraps any callable:
+
+- results are keyed by the (decayed) arguments, which must be hashable
+- results are kept in a ShardedLruCache (see 3.6.3_ShardedLruCache.h): bounded,
+  least recently used first out, optionally expiring after a time-to-live, and
+  sharded so that lookups from many threads rarely contend
+- the subject is called outside any lock; two threads missing on the same key may
+  both call it
+- hit, miss, eviction and expiry counters report how well the cache is doing */
+template <typename Signature>
+class CachingProxy;
+
+template <typename Result, typename... Args>
+class CachingProxy<Result(Args...)> {
+	using Clock = std::chrono::steady_clock;
+	using Key = std::tuple<typename std::decay<Args>::type...>;
+
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			return hash(key, std::index_sequence_for<Args...>());
+		}
+
+		template <size_t... I>
+		static size_t hash(const Key& key, std::index_sequence<I...>) {
+			size_t h = 0;
+			using expand = int[];
+			(void)expand{ 0, (h ^= std::hash<typename std::tuple_element<I, Key>::type>()(std::get<I>(key))
+				+ 0x9e3779b9 + (h << 6) + (h >> 2), 0)... };
+			return h;
+		}
+	};
+
+	ShardedLruCache<Key, Result, KeyHash> m_cache;
+	std::function<Result(Args...)> m_subject;
+
+public:
+	// A ttl of zero means results never expire
+	CachingProxy(std::function<Result(Args...)> subject, size_t capacity = 1024, size_t shards = 16,
+		Clock::duration ttl = Clock::duration::zero())
+		: m_cache(capacity, shards, ttl), m_subject(subject) {}
+
+	CachingProxy(const CachingProxy&) = delete;
+	CachingProxy& operator=(const CachingProxy&) = delete;
+
+	Result operator()(Args... args) {
+		return m_cache.get(Key(args...), [&]() {
+			return m_subject(std::forward<Args>(args)...);
+		});
+	}
+
+	void clear() {
+		m_cache.clear();
+	}
+
+	std::uint64_t getHits() const { return m_cache.getHits(); }
+	std::uint64_t getMisses() const { return m_cache.getMisses(); }
+	std::uint64_t getEvictions() const { return m_cache.getEvictions(); }
+	std::uint64_t getExpirations() const { return m_cache.getExpirations(); }
+
+	double getHitRate() const {
+		return m_cache.getHitRate();
+	}
+};
+
+// An expensive subject with a pure operation
+class ExchangeRateService {
+public:
+	double rate(const std::string& from, const std::string& to) const {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10)); // pretend to ask a remote server
+		return from == to ? 1.0 : static_cast<double>(from.size() * 7 % 5 + 1) / static_cast<double>(to.size() * 3 % 5 + 1);
+	}
+};
+
+void proxy_caching() {
+	ExchangeRateService service;
+	CachingProxy<double(const std::string&, const std::string&)> rate(
+		[&service](const std::string& from, const std::string& to) { return service.rate(from, to); },
+		2, 1, std::chrono::seconds(60));
+
+	const char* pairs[][2] = { { "GBP", "USD" }, { "GBP", "USD" }, { "EUR", "USD" }, { "GBP", "USD" }, { "JPY", "EUR" }, { "EUR", "USD" } };
+
+	auto start = std::chrono::steady_clock::now();
+	for (auto& pair : pairs) {
+		rate(pair[0], pair[1]);
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+	std::cout << "6 rate lookups took " << elapsed.count() << " ms: " << rate.getHits() << " hits, " << rate.getMisses()
+		<< " misses, " << rate.getEvictions() << " evictions, hit rate " << rate.getHitRate() << std::endl;
 }
\ No newline at end of file
@@ -0,0 +1,396 @@
+#pragma once
+
+/* Expression templates
+
+With ordinary operator overloading, a + b * c - d on vectors builds a temporary
+vector for every operator: three allocations and four passes over memory. With
+expression templates the operators build no vectors at all, only a small object
+describing the expression, whose type records its shape:
+
+	Difference<Sum<Matrix, Product<Matrix, Matrix> >, Matrix>
+
+The whole expression is evaluated when it is assigned to a Matrix or Vector, in a
+single loop computing result[i] = a[i] + b[i] * c[i] - d[i]. Everything inlines, so
+the compiler sees one plain loop and vectorizes it with SIMD instructions.
+
+Every expression derives from Expression<E>, which in turn derives from the CRTP
+Base<E>: operators take any Expression<E> and reach the concrete expression through
+derived(), without virtual calls.
+
+Vectors are matrices with one column; +, - and * are element-wise (* is not the
+matrix product, see multiply()) and a scalar can multiply any expression. Operands
+must have the same shape, otherwise std::invalid_argument is thrown. */
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <type_traits>
+#include <cstddef>
+
+#include "3.7_CuriouslyRecurringTemplate.h"
+
+namespace vector_math {
+	template <typename E>
+	class Expression : public Base<E> {
+	public:
+		double operator[](size_t i) const {
+			return this->derived()[i];
+		}
+
+		size_t rows() const {
+			return this->derived().rows();
+		}
+
+		size_t cols() const {
+			return this->derived().cols();
+		}
+
+		size_t size() const {
+			return rows() * cols();
+		}
+	};
+
+	class Matrix;
+
+	// Matrices are held by reference; expressions are small and held by value, so
+	// that an expression outliving its full expression (auto e = a + b * c) does
+	// not refer to destroyed temporaries
+	template <typename E>
+	using OperandType = typename std::conditional<std::is_base_of<Matrix, E>::value, const Matrix&, const E>::type;
+
+	class Matrix : public Expression<Matrix> {
+		size_t m_rows;
+		size_t m_cols;
+		std::vector<double> m_data; // row major
+
+		template <typename E>
+		void assign(const E& e) {
+			double* out = m_data.data();
+			const size_t n = m_data.size();
+			// Element i is only computed from the operands' element i, so writing into an
+			// operand (a = a + b) cannot disturb later elements: tell the compiler not to
+			// fall back to a scalar loop when it finds the result overlapping an operand
+#if defined(__clang__)
+#pragma clang loop vectorize(assume_safety)
+#elif defined(__GNUC__)
+#pragma GCC ivdep
+#elif defined(_MSC_VER)
+#pragma loop(ivdep)
+#endif
+			for (size_t i = 0; i < n; ++i) {
+				out[i] = e[i];
+			}
+		}
+
+	public:
+		Matrix(size_t rows, size_t cols, double value = 0.0) : m_rows(rows), m_cols(cols), m_data(rows * cols, value) {}
+
+		// Evaluates an expression in one pass
+		template <typename E>
+		Matrix(const Expression<E>& e) : m_rows(e.rows()), m_cols(e.cols()), m_data(e.size()) {
+			assign(e.derived());
+		}
+
+		// Assigning an expression that uses this matrix (a = a + b) is safe, see assign()
+		template <typename E>
+		Matrix& operator=(const Expression<E>& e) {
+			if (m_rows != e.rows() || m_cols != e.cols()) {
+				m_rows = e.rows();
+				m_cols = e.cols();
+				m_data.resize(e.size());
+			}
+			assign(e.derived());
+			return *this;
+		}
+
+		double operator[](size_t i) const {
+			return m_data[i];
+		}
+
+		double& operator[](size_t i) {
+			return m_data[i];
+		}
+
+		double operator()(size_t row, size_t col) const {
+			return m_data[row * m_cols + col];
+		}
+
+		double& operator()(size_t row, size_t col) {
+			return m_data[row * m_cols + col];
+		}
+
+		size_t rows() const {
+			return m_rows;
+		}
+
+		size_t cols() const {
+			return m_cols;
+		}
+
+		size_t size() const {
+			return m_data.size();
+		}
+	};
+
+	class Vector : public Matrix {
+	public:
+		explicit Vector(size_t size, double value = 0.0) : Matrix(size, 1, value) {}
+
+		template <typename E>
+		Vector(const Expression<E>& e) : Matrix(e) {
+			if (cols() != 1) {
+				throw std::invalid_argument("A vector has a single column");
+			}
+		}
+
+		template <typename E>
+		Vector& operator=(const Expression<E>& e) {
+			if (e.cols() != 1) {
+				throw std::invalid_argument("A vector has a single column");
+			}
+			Matrix::operator=(e);
+			return *this;
+		}
+	};
+
+	template <typename L, typename R, typename Operation>
+	class BinaryExpression : public Expression<BinaryExpression<L, R, Operation> > {
+		OperandType<L> m_left;
+		OperandType<R> m_right;
+
+	public:
+		BinaryExpression(const L& left, const R& right) : m_left(left), m_right(right) {
+			if (left.rows() != right.rows() || left.cols() != right.cols()) {
+				throw std::invalid_argument("Operands of different shapes");
+			}
+		}
+
+		double operator[](size_t i) const {
+			return Operation::apply(m_left[i], m_right[i]);
+		}
+
+		size_t rows() const {
+			return m_left.rows();
+		}
+
+		size_t cols() const {
+			return m_left.cols();
+		}
+	};
+
+	template <typename E>
+	class ScaledExpression : public Expression<ScaledExpression<E> > {
+		double m_factor;
+		OperandType<E> m_operand;
+
+	public:
+		ScaledExpression(double factor, const E& operand) : m_factor(factor), m_operand(operand) {}
+
+		double operator[](size_t i) const {
+			return m_factor * m_operand[i];
+		}
+
+		size_t rows() const {
+			return m_operand.rows();
+		}
+
+		size_t cols() const {
+			return m_operand.cols();
+		}
+	};
+
+	struct Add {
+		static double apply(double left, double right) {
+			return left + right;
+		}
+	};
+
+	struct Subtract {
+		static double apply(double left, double right) {
+			return left - right;
+		}
+	};
+
+	struct Multiply {
+		static double apply(double left, double right) {
+			return left * right;
+		}
+	};
+
+	template <typename L, typename R>
+	using Sum = BinaryExpression<L, R, Add>;
+
+	template <typename L, typename R>
+	using Difference = BinaryExpression<L, R, Subtract>;
+
+	template <typename L, typename R>
+	using Product = BinaryExpression<L, R, Multiply>;
+
+	template <typename L, typename R>
+	Sum<L, R> operator+(const Expression<L>& left, const Expression<R>& right) {
+		return Sum<L, R>(left.derived(), right.derived());
+	}
+
+	template <typename L, typename R>
+	Difference<L, R> operator-(const Expression<L>& left, const Expression<R>& right) {
+		return Difference<L, R>(left.derived(), right.derived());
+	}
+
+	template <typename L, typename R>
+	Product<L, R> operator*(const Expression<L>& left, const Expression<R>& right) {
+		return Product<L, R>(left.derived(), right.derived());
+	}
+
+	template <typename E>
+	ScaledExpression<E> operator*(double factor, const Expression<E>& e) {
+		return ScaledExpression<E>(factor, e.derived());
+	}
+
+	template <typename E>
+	ScaledExpression<E> operator*(const Expression<E>& e, double factor) {
+		return ScaledExpression<E>(factor, e.derived());
+	}
+
+	// Reductions are fused in the same way: dot(a + b, c) makes no temporary
+	template <typename L, typename R>
+	double dot(const Expression<L>& left, const Expression<R>& right) {
+		if (left.rows() != right.rows() || left.cols() != right.cols()) {
+			throw std::invalid_argument("Operands of different shapes");
+		}
+		const L& l = left.derived();
+		const R& r = right.derived();
+		double result = 0.0;
+		const size_t n = left.size();
+		for (size_t i = 0; i < n; ++i) {
+			result += l[i] * r[i];
+		}
+		return result;
+	}
+
+	// The matrix product reads every element of the vector once per row, so the vector
+	// expression is evaluated once up front rather than lazily
+	template <typename E>
+	Vector multiply(const Matrix& m, const Expression<E>& v) {
+		if (v.cols() != 1 || v.rows() != m.cols()) {
+			throw std::invalid_argument("Matrix and vector sizes do not match");
+		}
+		Vector x(v);
+		Vector result(m.rows());
+		for (size_t row = 0; row < m.rows(); ++row) {
+			double sum = 0.0;
+			for (size_t col = 0; col < m.cols(); ++col) {
+				sum += m(row, col) * x[col];
+			}
+			result[row] = sum;
+		}
+		return result;
+	}
+
+	inline std::ostream& operator<<(std::ostream& out, const Matrix& m) {
+		for (size_t row = 0; row < m.rows(); ++row) {
+			for (size_t col = 0; col < m.cols(); ++col) {
+				out << (col == 0 ? "" : " ") << m(row, col);
+			}
+			out << std::endl;
+		}
+		return out;
+	}
+}
+
+void crtp_expression_templates() {
+	using namespace vector_math;
+
+	Vector a(4, 1.0), b(4), c(4, 3.0), d(4, 0.5);
+	for (size_t i = 0; i < b.size(); ++i) {
+		b[i] = static_cast<double>(i);
+	}
+
+	Vector result = a + b * c - d; // one loop, no temporary vectors
+	std::cout << "a + b * c - d =" << std::endl << result;
+	std::cout << "dot(a + b, c) = " << dot(a + b, c) << std::endl;
+
+	Matrix m(2, 4);
+	for (size_t col = 0; col < m.cols(); ++col) {
+		m(0, col) = 1.0;
+		m(1, col) = static_cast<double>(col);
+	}
+	std::cout << "m * (2 * b) =" << std::endl << multiply(m, 2.0 * b);
+
+	try {
+		Vector wrong = a + Vector(3);
+	}
+	catch (const std::invalid_argument& e) {
+		std::cout << "a + Vector(3): " << e.what() << std::endl;
+	}
+}
+
+// Plain operator overloading, where every operator returns a new vector
+struct NaiveVector {
+	std::vector<double> data;
+
+	explicit NaiveVector(size_t size, double value = 0.0) : data(size, value) {}
+
+	friend NaiveVector operator+(const NaiveVector& left, const NaiveVector& right) {
+		NaiveVector result(left.data.size());
+		for (size_t i = 0; i < left.data.size(); ++i) {
+			result.data[i] = left.data[i] + right.data[i];
+		}
+		return result;
+	}
+
+	friend NaiveVector operator-(const NaiveVector& left, const NaiveVector& right) {
+		NaiveVector result(left.data.size());
+		for (size_t i = 0; i < left.data.size(); ++i) {
+			result.data[i] = left.data[i] - right.data[i];
+		}
+		return result;
+	}
+
+	friend NaiveVector operator*(const NaiveVector& left, const NaiveVector& right) {
+		NaiveVector result(left.data.size());
+		for (size_t i = 0; i < left.data.size(); ++i) {
+			result.data[i] = left.data[i] * right.data[i];
+		}
+		return result;
+	}
+};
+
+void crtp_expression_templates_benchmark(size_t size = 1000000, int iterations = 200) {
+	using Clock = std::chrono::steady_clock;
+	auto ms = [](Clock::duration d) {
+		return std::chrono::duration<double, std::milli>(d).count();
+	};
+
+	// Each iteration feeds on the last, so the compiler cannot hoist the work out of the loop
+	vector_math::Vector a(size, 1.0), b(size, 2.0), c(size, 3.0), result(size);
+	NaiveVector na(size, 1.0), nb(size, 2.0), nc(size, 3.0), naiveResult(size);
+
+	auto start = Clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		naiveResult = na + nb * nc - naiveResult;
+	}
+	auto naive = Clock::now() - start;
+
+	start = Clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		result = a + b * c - result;
+	}
+	auto fused = Clock::now() - start;
+
+	// What the expression template should compile down to
+	std::vector<double> handResult(size);
+	start = Clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		for (size_t j = 0; j < size; ++j) {
+			handResult[j] = na.data[j] + nb.data[j] * nc.data[j] - handResult[j];
+		}
+	}
+	auto hand = Clock::now() - start;
+
+	std::cout << iterations << " x (result = a + b * c - result) on " << size << " doubles" << std::endl
+		<< "Operator overloading with temporaries: " << ms(naive) << " ms" << std::endl
+		<< "Expression templates: " << ms(fused) << " ms" << std::endl
+		<< "Hand-written loop: " << ms(hand) << " ms" << std::endl
+		<< "Results: " << naiveResult.data[size - 1] << " " << result[size - 1] << " " << handResult[size - 1] << std::endl;
+}
\ No newline at end of file
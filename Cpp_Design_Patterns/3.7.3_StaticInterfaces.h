@@ -0,0 +1,523 @@
+#pragma once
+
+/* Static interfaces
+
+Shape/DrawingAPI (Bridge), StrategyInterface (Strategy), Expression (Interpreter),
+CarElement (Visitor) and Handler (Chain of Responsibility) are all used through
+virtual functions. Where the concrete type is known at compile time, CRTP gives the
+same interface without the virtual call: the interface is a class template Base<Impl>
+whose functions call the implementation through derived(), and everything inlines.
+
+	template <typename Impl>
+	class Shape : public Base<Impl> {
+	public:
+		void draw() { this->derived().drawImpl(); }
+	};
+
+	class CircleShape : public Shape<CircleShape> {
+	public:
+		void drawImpl() { ... }
+	};
+
+The price is that Shape<CircleShape> and Shape<RingShape> are unrelated types, so
+there is no common base to keep in one container. Static interfaces suit collections
+of one type, e.g. std::vector<CircleShape<DrawingAPI1> >, or one such collection per
+type. A mix of types needs either virtual functions or a closed set of alternatives,
+std::variant (C++17), which dispatches through a jump table instead of a vtable.
+
+The counterparts live in namespace static_interface, with the names of the classes
+they mirror. crtp_dispatch_benchmark() measures the three kinds of dispatch on shapes,
+over collection sizes from L1 cache to main memory and different mixes of types. */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#include <variant>
+#define STATIC_INTERFACE_HAS_VARIANT
+#endif
+
+#include "3.2_Bridge.h"
+#include "3.7_CuriouslyRecurringTemplate.h"
+
+namespace static_interface {
+	// Bridge: the implementor is a template parameter rather than a pointer
+	template <typename Impl>
+	class DrawingAPI : public Base<Impl> {
+	public:
+		void drawCircle(double x, double y, double radius) {
+			this->derived().drawCircleImpl(x, y, radius);
+		}
+	};
+
+	class DrawingAPI1 : public DrawingAPI<DrawingAPI1> {
+	public:
+		void drawCircleImpl(double x, double y, double radius) {
+			std::cout << "API1.circle at " << x << ':' << y << ' ' << radius << std::endl;
+		}
+	};
+
+	class DrawingAPI2 : public DrawingAPI<DrawingAPI2> {
+	public:
+		void drawCircleImpl(double x, double y, double radius) {
+			std::cout << "API2.circle at " << x << ':' << y << ' ' << radius << std::endl;
+		}
+	};
+
+	template <typename Impl>
+	class Shape : public Base<Impl> {
+	public:
+		void draw() {
+			this->derived().drawImpl();
+		}
+
+		void resizeByPercentage(double pct) {
+			this->derived().resizeByPercentageImpl(pct);
+		}
+	};
+
+	template <typename API>
+	class CircleShape : public Shape<CircleShape<API> > {
+		double m_x, m_y, m_radius;
+		DrawingAPI<API>* m_drawingAPI;
+
+	public:
+		CircleShape(double x, double y, double radius, DrawingAPI<API>* drawingAPI) :
+			m_x(x), m_y(y), m_radius(radius), m_drawingAPI(drawingAPI) {}
+
+		void drawImpl() {
+			m_drawingAPI->drawCircle(m_x, m_y, m_radius);
+		}
+
+		void resizeByPercentageImpl(double pct) {
+			m_radius *= pct;
+		}
+	};
+
+	template <typename API>
+	class RingShape : public Shape<RingShape<API> > {
+		double m_x, m_y, m_inner, m_outer;
+		DrawingAPI<API>* m_drawingAPI;
+
+	public:
+		RingShape(double x, double y, double inner, double outer, DrawingAPI<API>* drawingAPI) :
+			m_x(x), m_y(y), m_inner(inner), m_outer(outer), m_drawingAPI(drawingAPI) {}
+
+		void drawImpl() {
+			m_drawingAPI->drawCircle(m_x, m_y, m_inner);
+			m_drawingAPI->drawCircle(m_x, m_y, m_outer);
+		}
+
+		void resizeByPercentageImpl(double pct) {
+			m_inner *= pct;
+			m_outer *= pct;
+		}
+	};
+
+	// Strategy: the context is bound to its strategy at compile time, so there is no set_strategy()
+	template <typename Impl>
+	class StrategyInterface : public Base<Impl> {
+	public:
+		void execute() const {
+			this->derived().executeImpl();
+		}
+	};
+
+	class ConcreteStrategyA : public StrategyInterface<ConcreteStrategyA> {
+	public:
+		void executeImpl() const {
+			std::cout << "Called ConcreteStrategyA execute method" << std::endl;
+		}
+	};
+
+	class ConcreteStrategyB : public StrategyInterface<ConcreteStrategyB> {
+	public:
+		void executeImpl() const {
+			std::cout << "Called ConcreteStrategyB execute method" << std::endl;
+		}
+	};
+
+	class ConcreteStrategyC : public StrategyInterface<ConcreteStrategyC> {
+	public:
+		void executeImpl() const {
+			std::cout << "Called ConcreteStrategyC execute method" << std::endl;
+		}
+	};
+
+	template <typename Strategy>
+	class Context {
+		const StrategyInterface<Strategy>& m_strategy;
+
+	public:
+		explicit Context(const StrategyInterface<Strategy>& strategy) : m_strategy(strategy) {}
+
+		void execute() const {
+			m_strategy.execute();
+		}
+	};
+
+	// Interpreter: the syntax tree is a type, Plus<Variable, Minus<Variable, Variable> >,
+	// built by the compiler instead of a parser
+	using Variables = std::map<std::string, int>;
+
+	template <typename Impl>
+	class Expression : public Base<Impl> {
+	public:
+		int interpret(const Variables& variables) const {
+			return this->derived().interpretImpl(variables);
+		}
+	};
+
+	class Number : public Expression<Number> {
+		int m_number;
+
+	public:
+		explicit Number(int number) : m_number(number) {}
+
+		int interpretImpl(const Variables&) const {
+			return m_number;
+		}
+	};
+
+	class Variable : public Expression<Variable> {
+		std::string m_name;
+
+	public:
+		explicit Variable(const std::string& name) : m_name(name) {}
+
+		int interpretImpl(const Variables& variables) const {
+			auto it = variables.find(m_name);
+			return it == variables.end() ? 0 : it->second;
+		}
+	};
+
+	template <typename L, typename R>
+	class Plus : public Expression<Plus<L, R> > {
+		L m_left;
+		R m_right;
+
+	public:
+		Plus(const L& left, const R& right) : m_left(left), m_right(right) {}
+
+		int interpretImpl(const Variables& variables) const {
+			return m_left.interpret(variables) + m_right.interpret(variables);
+		}
+	};
+
+	template <typename L, typename R>
+	class Minus : public Expression<Minus<L, R> > {
+		L m_left;
+		R m_right;
+
+	public:
+		Minus(const L& left, const R& right) : m_left(left), m_right(right) {}
+
+		int interpretImpl(const Variables& variables) const {
+			return m_left.interpret(variables) - m_right.interpret(variables);
+		}
+	};
+
+	template <typename L, typename R>
+	Plus<L, R> operator+(const Expression<L>& left, const Expression<R>& right) {
+		return Plus<L, R>(left.derived(), right.derived());
+	}
+
+	template <typename L, typename R>
+	Minus<L, R> operator-(const Expression<L>& left, const Expression<R>& right) {
+		return Minus<L, R>(left.derived(), right.derived());
+	}
+
+	// Visitor: accept() is a template over the visitor, which overloads visit() for each
+	// element; the car keeps its wheels in a homogeneous collection
+	template <typename Impl>
+	class CarElement : public Base<Impl> {
+	public:
+		template <typename Visitor>
+		void accept(const Visitor& visitor) {
+			visitor.visit(this->derived());
+		}
+	};
+
+	class Wheel : public CarElement<Wheel> {
+		std::string m_name;
+
+	public:
+		explicit Wheel(const std::string& name) : m_name(name) {}
+
+		const std::string& getName() const {
+			return m_name;
+		}
+	};
+
+	class Engine : public CarElement<Engine> {};
+
+	class Body : public CarElement<Body> {};
+
+	class Car {
+		std::vector<Wheel> m_wheels;
+		Body m_body;
+		Engine m_engine;
+
+	public:
+		Car() : m_wheels{ Wheel("front left"), Wheel("front right"), Wheel("back left"), Wheel("back right") } {}
+
+		template <typename Visitor>
+		void accept(const Visitor& visitor) {
+			for (Wheel& wheel : m_wheels) {
+				wheel.accept(visitor);
+			}
+			m_body.accept(visitor);
+			m_engine.accept(visitor);
+		}
+	};
+
+	class CarElementPrintVisitor {
+	public:
+		void visit(Wheel& wheel) const {
+			std::cout << "Visiting " << wheel.getName() << " wheel" << std::endl;
+		}
+		void visit(Engine&) const {
+			std::cout << "Visiting engine" << std::endl;
+		}
+		void visit(Body&) const {
+			std::cout << "Visiting body" << std::endl;
+		}
+	};
+
+	class CarElementDoVisitor {
+	public:
+		void visit(Wheel& wheel) const {
+			std::cout << "Kicking my " << wheel.getName() << " wheel" << std::endl;
+		}
+		void visit(Engine&) const {
+			std::cout << "Starting my engine" << std::endl;
+		}
+		void visit(Body&) const {
+			std::cout << "Moving my body" << std::endl;
+		}
+	};
+
+	// Chain of Responsibility: each handler holds the rest of the chain by value, so the
+	// whole chain is one object and passing a request on is an inlined call
+	template <typename Impl>
+	class Handler : public Base<Impl> {
+	public:
+		void request(int value) {
+			this->derived().requestImpl(value);
+		}
+	};
+
+	class EndOfChain : public Handler<EndOfChain> {
+	public:
+		void requestImpl(int) {
+			std::cout << "Sorry, no handler could handle the request." << std::endl;
+		}
+	};
+
+	template <typename Next>
+	class SpecialHandler : public Handler<SpecialHandler<Next> > {
+		int m_limit;
+		int m_id;
+		Next m_next;
+
+	public:
+		SpecialHandler(int limit, int id, const Next& next) : m_limit(limit), m_id(id), m_next(next) {}
+
+		void requestImpl(int value) {
+			if (value < m_limit) {
+				std::cout << "Handler " << m_id << " handled the request with a limit of " << m_limit << std::endl;
+			}
+			else {
+				m_next.request(value);
+			}
+		}
+	};
+
+	template <typename Next>
+	SpecialHandler<Next> makeHandler(int limit, int id, const Next& next) {
+		return SpecialHandler<Next>(limit, id, next);
+	}
+}
+
+void crtp_static_interfaces() {
+	// Using declarations rather than a using directive, which would make every name
+	// ambiguous with the virtual classes it mirrors
+	using static_interface::DrawingAPI1;
+	using static_interface::DrawingAPI2;
+	using static_interface::CircleShape;
+	using static_interface::ConcreteStrategyA;
+	using static_interface::ConcreteStrategyB;
+	using static_interface::Context;
+	using static_interface::Variable;
+	using static_interface::Variables;
+	using static_interface::Number;
+	using static_interface::Car;
+	using static_interface::CarElementPrintVisitor;
+	using static_interface::CarElementDoVisitor;
+	using static_interface::EndOfChain;
+	using static_interface::makeHandler;
+
+	DrawingAPI1 api1;
+	DrawingAPI2 api2;
+	CircleShape<DrawingAPI1> circle1(1, 2, 3, &api1);
+	CircleShape<DrawingAPI2> circle2(5, 7, 11, &api2);
+	circle1.resizeByPercentage(2.5);
+	circle2.resizeByPercentage(2.5);
+	circle1.draw();
+	circle2.draw();
+
+	ConcreteStrategyA concreteStrategyA;
+	ConcreteStrategyB concreteStrategyB;
+	Context<ConcreteStrategyA> contextA(concreteStrategyA);
+	Context<ConcreteStrategyB> contextB(concreteStrategyB);
+	contextA.execute();
+	contextB.execute();
+
+	auto sentence = Variable("w") + (Variable("x") - Variable("z")); // w + (x - z)
+	std::cout << "Interpreter result: " << sentence.interpret(Variables{ { "w", 5 }, { "x", 10 }, { "z", 42 } }) << std::endl;
+	std::cout << "Interpreter result: " << (sentence - Number(1)).interpret(Variables{ { "w", 1 }, { "x", 3 }, { "z", 2 } }) << std::endl;
+
+	Car car;
+	car.accept(CarElementPrintVisitor());
+	car.accept(CarElementDoVisitor());
+
+	auto chain = makeHandler(10, 1, makeHandler(20, 2, makeHandler(30, 3, EndOfChain())));
+	chain.request(18);
+	chain.request(40);
+}
+
+// A second virtual shape, so that collections can mix types
+class RingShape : public Shape {
+	double m_x, m_y, m_inner, m_outer;
+	DrawingAPI *m_drawingAPI;
+public:
+	RingShape(double x, double y, double inner, double outer, DrawingAPI *drawingAPI) :
+		m_x(x), m_y(y), m_inner(inner), m_outer(outer), m_drawingAPI(drawingAPI) {}
+
+	void draw() {
+		m_drawingAPI->drawCircle(m_x, m_y, m_inner);
+		m_drawingAPI->drawCircle(m_x, m_y, m_outer);
+	}
+	void resizeByPercentage(double pct) {
+		m_inner *= pct;
+		m_outer *= pct;
+	}
+};
+
+/* Calls resizeByPercentage() on every shape of a collection, alternately growing and
+shrinking so that the sizes stay bounded, and reports nanoseconds per call for:
+
+- virtual: std::vector<std::unique_ptr<Shape> >, each shape on the heap
+- CRTP: one std::vector per concrete type, visited one after the other
+- variant: one std::vector of std::variant, visited with std::visit (C++17 only)
+
+for each collection size and mix of circles and rings:
+
+- uniform: circles only
+- 90/10 and 50/50: randomly interleaved, which defeats the branch predictor for the
+  indirect call; at 50/50 it is wrong about half the time
+- 50/50 grouped: all the circles, then all the rings */
+void crtp_dispatch_benchmark(size_t callsPerCase = 20000000) {
+	using Clock = std::chrono::steady_clock;
+	using StaticCircle = static_interface::CircleShape<static_interface::DrawingAPI1>;
+	using StaticRing = static_interface::RingShape<static_interface::DrawingAPI1>;
+
+	struct Mix {
+		const char* name;
+		double rings; // fraction of rings
+		bool grouped;
+	};
+	const Mix mixes[] = { { "uniform", 0.0, false }, { "90/10", 0.1, false }, { "50/50", 0.5, false }, { "50/50 grouped", 0.5, true } };
+	const size_t sizes[] = { 1000, 100000, 1000000 };
+
+	DrawingAPI1 virtualAPI;
+	static_interface::DrawingAPI1 staticAPI;
+
+	std::cout << std::setw(10) << "shapes" << std::setw(16) << "mix" << std::setw(12) << "virtual" << std::setw(12) << "CRTP"
+		<< std::setw(12) << "variant" << "   (ns per call)" << std::endl;
+
+	for (size_t size : sizes) {
+		for (const Mix& mix : mixes) {
+			std::mt19937 random(42);
+			std::bernoulli_distribution isRing(mix.rings);
+			std::vector<bool> rings(size);
+			for (size_t i = 0; i < size; ++i) {
+				rings[i] = isRing(random);
+			}
+			if (mix.grouped) {
+				std::sort(rings.begin(), rings.end());
+			}
+
+			std::vector<std::unique_ptr<Shape> > virtualShapes;
+			std::vector<StaticCircle> staticCircles;
+			std::vector<StaticRing> staticRings;
+#ifdef STATIC_INTERFACE_HAS_VARIANT
+			std::vector<std::variant<StaticCircle, StaticRing> > variantShapes;
+#endif
+			for (size_t i = 0; i < size; ++i) {
+				if (rings[i]) {
+					virtualShapes.emplace_back(new RingShape(0, 0, 1, 2, &virtualAPI));
+					staticRings.emplace_back(0, 0, 1, 2, &staticAPI);
+#ifdef STATIC_INTERFACE_HAS_VARIANT
+					variantShapes.emplace_back(StaticRing(0, 0, 1, 2, &staticAPI));
+#endif
+				}
+				else {
+					virtualShapes.emplace_back(new CircleShape(0, 0, 1, &virtualAPI));
+					staticCircles.emplace_back(0, 0, 1, &staticAPI);
+#ifdef STATIC_INTERFACE_HAS_VARIANT
+					variantShapes.emplace_back(StaticCircle(0, 0, 1, &staticAPI));
+#endif
+				}
+			}
+
+			const size_t passes = std::max<size_t>(2, callsPerCase / size);
+			auto nsPerCall = [&](Clock::duration d) {
+				return std::chrono::duration<double, std::nano>(d).count() / static_cast<double>(passes * size);
+			};
+
+			auto start = Clock::now();
+			for (size_t pass = 0; pass < passes; ++pass) {
+				double pct = pass % 2 == 0 ? 1.25 : 0.8;
+				for (std::unique_ptr<Shape>& shape : virtualShapes) {
+					shape->resizeByPercentage(pct);
+				}
+			}
+			double virtualTime = nsPerCall(Clock::now() - start);
+
+			start = Clock::now();
+			for (size_t pass = 0; pass < passes; ++pass) {
+				double pct = pass % 2 == 0 ? 1.25 : 0.8;
+				for (StaticCircle& shape : staticCircles) {
+					shape.resizeByPercentage(pct);
+				}
+				for (StaticRing& shape : staticRings) {
+					shape.resizeByPercentage(pct);
+				}
+			}
+			double crtpTime = nsPerCall(Clock::now() - start);
+
+			std::cout << std::setw(10) << size << std::setw(16) << mix.name << std::setw(12) << virtualTime << std::setw(12) << crtpTime;
+
+#ifdef STATIC_INTERFACE_HAS_VARIANT
+			start = Clock::now();
+			for (size_t pass = 0; pass < passes; ++pass) {
+				double pct = pass % 2 == 0 ? 1.25 : 0.8;
+				for (auto& shape : variantShapes) {
+					std::visit([pct](auto& s) { s.resizeByPercentage(pct); }, shape);
+				}
+			}
+			std::cout << std::setw(12) << nsPerCall(Clock::now() - start) << std::endl;
+#else
+			std::cout << std::setw(12) << "n/a" << std::endl;
+#endif
+		}
+	}
+}
\ No newline at end of file
@@ -8,10 +8,37 @@ The curiously recurring template pattern (CRTP) is an idiom in C++ in which
 a class X derives from a class template instantiation using X itself as a
 template argument. */
 
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <typeinfo>
+#include <cstdlib>
+#include <cstdint>
+
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 // The Curiously Recurring Template Pattern (CRTP)
 template<class T>
 class Base {
 	// methods within Base can use template to access members of Derived
+public:
+	T& derived() {
+		return static_cast<T&>(*this);
+	}
+
+	const T& derived() const {
+		return static_cast<const T&>(*this);
+	}
 };
 
 class Derived : public Base<Derived> {
@@ -29,35 +56,156 @@ destroyed, the alive count is decremented. It is important to note that counter<
 and counter<Y> are two separate classes and this is why they will keep separate
 counts of X's and Y's. In this example of CRTP, this distinction of classes is the
 only use of the template parameter (T in counter<T>) and the reason why we cannot
-use a simple un-templated base class. */
+use a simple un-templated base class.
+
+Objects are created and destroyed on many threads at once, so the counts are
+kept in per-core shards rather than plain ints (a data race) or a single atomic
+(every core fighting over one cache line). Each shard is padded to its own cache
+line; a constructor counts into the shard of the core it runs on, and reading a
+count sums the shards. Every counter<T> in use registers itself with the
+CounterRegistry, which reports the counts of all counted types by name. */
+
+namespace object_counting {
+	const size_t CacheLineSize = 64;
+	const size_t ShardCount = 64; // a power of two
+
+	struct alignas(CacheLineSize) Shard {
+		std::atomic<std::int64_t> created;
+		std::atomic<std::int64_t> alive; // a shard can go negative, only the sum is meaningful
+	};
+
+	// Threads can migrate between cores, so the shards are still updated atomically,
+	// but two threads rarely update the same one
+	inline size_t currentShard() {
+#ifdef __linux__
+		int cpu = sched_getcpu();
+		if (cpu >= 0) {
+			return static_cast<size_t>(cpu) & (ShardCount - 1);
+		}
+#endif
+		// Without a cheap way to ask for the core, each thread keeps the shard it was given
+		static std::atomic<size_t> next(0);
+		thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed) & (ShardCount - 1);
+		return shard;
+	}
+
+	inline std::string typeName(const std::type_info& type) {
+#ifdef __GNUG__
+		int status = 0;
+		char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+		if (status == 0 && demangled != nullptr) {
+			std::string name(demangled);
+			std::free(demangled);
+			return name;
+		}
+#endif
+		return type.name();
+	}
+
+	struct Counts {
+		std::int64_t created;
+		std::int64_t alive;
+	};
+
+	// Not a snapshot: counts that change while the shards are summed may be missed or
+	// half seen, which is fine for statistics
+	inline Counts sum(const Shard* shards) {
+		Counts counts = { 0, 0 };
+		for (size_t i = 0; i < ShardCount; ++i) {
+			counts.created += shards[i].created.load(std::memory_order_relaxed);
+			counts.alive += shards[i].alive.load(std::memory_order_relaxed);
+		}
+		return counts;
+	}
+
+	class CounterRegistry {
+	public:
+		struct Entry {
+			std::string name;
+			Counts counts;
+		};
+
+	private:
+		std::mutex m_mutex;
+		std::vector<std::pair<const std::type_info*, const Shard*> > m_counters;
+
+		CounterRegistry() {}
+
+	public:
+		// Constructed on first use, so counters in any translation unit can register during static initialisation
+		static CounterRegistry& instance() {
+			static CounterRegistry registry;
+			return registry;
+		}
+
+		void add(const std::type_info& type, const Shard* shards) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_counters.emplace_back(&type, shards);
+		}
+
+		std::vector<Entry> entries() {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			std::vector<Entry> result;
+			for (const auto& counter : m_counters) {
+				result.push_back(Entry{ typeName(*counter.first), sum(counter.second) });
+			}
+			return result;
+		}
+
+		void report(std::ostream& out) {
+			for (const Entry& entry : entries()) {
+				out << entry.name << ": " << entry.counts.created << " created, " << entry.counts.alive << " alive" << std::endl;
+			}
+		}
+	};
+}
 
 template <typename T>
 struct counter {
-	static int objects_created;
-	static int objects_alive;
-
 	counter() {
-		++objects_created;
-		++objects_alive;
+		count();
 	}
 
 	counter(const counter&) {
-		++objects_created;
-		++objects_alive;
+		count();
+	}
+
+	static std::int64_t objects_created() {
+		return object_counting::sum(statistics.shards).created;
+	}
+
+	static std::int64_t objects_alive() {
+		return object_counting::sum(statistics.shards).alive;
 	}
 
 protected:
 	// objects should never be removed through pointers of this type
 	~counter() {
-		--objects_alive;
+		statistics.shards[object_counting::currentShard()].alive.fetch_sub(1, std::memory_order_relaxed);
 	}
-};
 
-template <typename T>
-int counter<T>::objects_created(0);
+private:
+	// The shards live in static storage and start out zeroed, so objects created
+	// before the registration below has run are still counted
+	struct Statistics {
+		object_counting::Shard shards[object_counting::ShardCount];
+
+		Statistics() {
+			object_counting::CounterRegistry::instance().add(typeid(T), shards);
+		}
+	};
+
+	static Statistics statistics;
+
+	static void count() {
+		object_counting::Shard& shard = statistics.shards[object_counting::currentShard()];
+		shard.created.fetch_add(1, std::memory_order_relaxed);
+		shard.alive.fetch_add(1, std::memory_order_relaxed);
+	}
+};
 
 template <typename T>
-int counter<T>::objects_alive(0);
+typename counter<T>::Statistics counter<T>::statistics;
 
 class X : counter<X> {
 	// ...
@@ -65,4 +213,89 @@ class X : counter<X> {
 
 class Y : counter<Y> {
 	// ...
-};
\ No newline at end of file
+};
+
+void crtp_counter() {
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([]() {
+			std::vector<X> xs;
+			xs.reserve(2000);
+			xs.resize(1000);
+			for (int i = 0; i < 1000; ++i) {
+				Y y;
+				xs.push_back(X(xs.back())); // copies are counted too
+			}
+		});
+	}
+	X survivor;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+
+	std::cout << "X: " << counter<X>::objects_created() << " created, " << counter<X>::objects_alive() << " alive" << std::endl;
+	object_counting::CounterRegistry::instance().report(std::cout);
+}
+
+// A counter that keeps both counts in one shared cache line, for comparison
+template <typename T>
+struct shared_counter {
+	static std::atomic<std::int64_t> objects_created;
+	static std::atomic<std::int64_t> objects_alive;
+
+	shared_counter() {
+		objects_created.fetch_add(1, std::memory_order_relaxed);
+		objects_alive.fetch_add(1, std::memory_order_relaxed);
+	}
+
+protected:
+	~shared_counter() {
+		objects_alive.fetch_sub(1, std::memory_order_relaxed);
+	}
+};
+
+template <typename T>
+std::atomic<std::int64_t> shared_counter<T>::objects_created(0);
+
+template <typename T>
+std::atomic<std::int64_t> shared_counter<T>::objects_alive(0);
+
+struct ShardedCounted : counter<ShardedCounted> {};
+struct SharedCounted : shared_counter<SharedCounted> {};
+
+void crtp_counter_benchmark(size_t objectsPerThread = 10000000) {
+	using Clock = std::chrono::steady_clock;
+	unsigned threadCount = std::max(2u, std::thread::hardware_concurrency());
+
+	// Each thread creates and destroys objects as fast as it can
+	auto run = [&](void (*churn)(size_t)) {
+		std::vector<std::thread> threads;
+		auto start = Clock::now();
+		for (unsigned t = 0; t < threadCount; ++t) {
+			threads.emplace_back(churn, objectsPerThread);
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	};
+
+	double shared = run([](size_t n) {
+		for (size_t i = 0; i < n; ++i) {
+			SharedCounted object;
+			(void)object;
+		}
+	});
+	double sharded = run([](size_t n) {
+		for (size_t i = 0; i < n; ++i) {
+			ShardedCounted object;
+			(void)object;
+		}
+	});
+
+	double objects = static_cast<double>(objectsPerThread) * threadCount;
+	std::cout << threadCount << " threads creating " << objectsPerThread << " objects each" << std::endl
+		<< "Shared atomic counter: " << shared << " ms (" << shared * 1e6 / objects << " ns per object)" << std::endl
+		<< "Sharded counter: " << sharded << " ms (" << sharded * 1e6 / objects << " ns per object)" << std::endl
+		<< "Counted: " << SharedCounted::objects_created.load() << " and " << ShardedCounted::objects_created() << std::endl;
+}
\ No newline at end of file
@@ -0,0 +1,364 @@
+#pragma once
+
+/* Plugins
+
+Modules plugged in at run time: each plugin is a shared library (.so, .dylib or
+.dll) in a plugin directory, implementing one or more interfaces published by the
+application. PluginLoader:
+
+- only scans the directory when it is constructed; nothing is opened, so startup
+  costs the same with hundreds of plugins installed
+- opens a plugin the first time one of its interfaces is asked for, checks that it
+  was built against the same plugin ABI version, and binds its entry points
+- creates each interface of a plugin once and hands out the cached pointer after
+  that; instances are destroyed by the plugin that created them, and plugins are
+  unloaded when the loader is destroyed
+
+An interface is an abstract class with a static interfaceName(), which includes
+its version, so that a plugin written against an older version is not mistaken
+for the new one. A plugin exports three C functions:
+
+	#include "3.8.1_PluginLoader.h"
+
+	class EnglishGreeter : public Greeter {
+	public:
+		std::string greet(const std::string& name) const override {
+			return "Hello " + name;
+		}
+	};
+
+	IBP_PLUGIN_EXPORT unsigned ibp_plugin_abi_version() {
+		return plugins::AbiVersion;
+	}
+
+	IBP_PLUGIN_EXPORT void* ibp_plugin_create(const char* interfaceName) {
+		if (std::strcmp(interfaceName, Greeter::interfaceName()) == 0) {
+			return static_cast<Greeter*>(new EnglishGreeter()); // cast to the interface before void*
+		}
+		return nullptr;
+	}
+
+	IBP_PLUGIN_EXPORT void ibp_plugin_destroy(const char* interfaceName, void* instance) {
+		if (std::strcmp(interfaceName, Greeter::interfaceName()) == 0) {
+			delete static_cast<Greeter*>(instance);
+		}
+	}
+
+and is built as a shared library. plugins/english_greeter.cpp is such a plugin, and
+plugins/stale_greeter.cpp one built for another plugin ABI; "main - laptop.bat" and
+the Visual Studio project build both into plugins/ before main. By hand, from this
+directory:
+
+	g++ -std=c++14 -shared -fPIC plugins/english_greeter.cpp -o plugins/english_greeter.so
+	g++ -std=c++14 -shared -fPIC plugins/stale_greeter.cpp -o plugins/stale_greeter.so
+
+ibp_plugins() loads every plugin it finds, greets through it and unloads it, and
+ibp_plugins_check() checks that the first is loaded lazily and its instance cached,
+and the second refused. Interfaces are C++ classes with vtables, so the application
+and its plugins must be built with the same compiler and standard library. */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+// Keep windows.h from clashing with names used elsewhere in the project (e.g. Ellipse)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef NOGDI
+#define NOGDI
+#endif
+#include <windows.h>
+#define IBP_PLUGIN_EXPORT extern "C" __declspec(dllexport)
+#else
+#include <dlfcn.h>
+#include <dirent.h>
+#define IBP_PLUGIN_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+namespace plugins {
+	// Raised whenever the entry points or their contract change
+	const unsigned AbiVersion = 1;
+
+	using AbiVersionFunction = unsigned (*)();
+	using CreateFunction = void* (*)(const char* interfaceName);
+	using DestroyFunction = void (*)(const char* interfaceName, void* instance);
+
+#if defined(_WIN32)
+	const char Extension[] = ".dll";
+#elif defined(__APPLE__)
+	const char Extension[] = ".dylib";
+#else
+	const char Extension[] = ".so";
+#endif
+}
+
+class PluginLoader {
+#ifdef _WIN32
+	using Library = HMODULE;
+#else
+	using Library = void*;
+#endif
+
+	struct Plugin {
+		std::string path;
+		Library library;
+		plugins::CreateFunction create;
+		plugins::DestroyFunction destroy;
+		std::map<std::string, void*> instances; // by interface name; null if not implemented
+	};
+
+	std::string m_directory;
+	std::map<std::string, Plugin> m_plugins; // by file name without the extension
+	std::mutex m_mutex;
+
+	static std::string lastError() {
+#ifdef _WIN32
+		return "error " + std::to_string(GetLastError());
+#else
+		const char* error = dlerror();
+		return error != nullptr ? error : "unknown error";
+#endif
+	}
+
+	static void* symbol(Library library, const char* name) {
+#ifdef _WIN32
+		return reinterpret_cast<void*>(GetProcAddress(library, name));
+#else
+		return dlsym(library, name);
+#endif
+	}
+
+	static void close(Library library) {
+#ifdef _WIN32
+		FreeLibrary(library);
+#else
+		dlclose(library);
+#endif
+	}
+
+	void scan() {
+		const std::string extension(plugins::Extension);
+		auto add = [this, &extension](const std::string& file) {
+			if (file.size() > extension.size() && file.compare(file.size() - extension.size(), extension.size(), extension) == 0) {
+				m_plugins[file.substr(0, file.size() - extension.size())] = Plugin{ m_directory + "/" + file, nullptr, nullptr, nullptr, {} };
+			}
+		};
+
+#ifdef _WIN32
+		WIN32_FIND_DATAA entry;
+		HANDLE search = FindFirstFileA((m_directory + "\\*").c_str(), &entry);
+		if (search == INVALID_HANDLE_VALUE) {
+			return;
+		}
+		do {
+			add(entry.cFileName);
+		} while (FindNextFileA(search, &entry));
+		FindClose(search);
+#else
+		DIR* directory = opendir(m_directory.c_str());
+		if (directory == nullptr) {
+			return;
+		}
+		while (dirent* entry = readdir(directory)) {
+			add(entry->d_name);
+		}
+		closedir(directory);
+#endif
+	}
+
+	// Destroys the plugin's instances and closes it; it is opened again when next asked for
+	static void unload(Plugin& plugin) {
+		if (plugin.library == nullptr) {
+			return;
+		}
+		for (auto& instance : plugin.instances) {
+			if (instance.second != nullptr) {
+				plugin.destroy(instance.first.c_str(), instance.second);
+			}
+		}
+		plugin.instances.clear();
+		close(plugin.library);
+		plugin.library = nullptr;
+		plugin.create = nullptr;
+		plugin.destroy = nullptr;
+	}
+
+	void open(const std::string& name, Plugin& plugin) {
+#ifdef _WIN32
+		Library library = LoadLibraryA(plugin.path.c_str());
+#else
+		// Lazy binding: the plugin's own symbols are resolved as its functions are first called
+		Library library = dlopen(plugin.path.c_str(), RTLD_LAZY | RTLD_LOCAL);
+#endif
+		if (library == nullptr) {
+			throw std::runtime_error("Cannot load plugin " + name + ": " + lastError());
+		}
+
+		auto version = reinterpret_cast<plugins::AbiVersionFunction>(symbol(library, "ibp_plugin_abi_version"));
+		auto create = reinterpret_cast<plugins::CreateFunction>(symbol(library, "ibp_plugin_create"));
+		auto destroy = reinterpret_cast<plugins::DestroyFunction>(symbol(library, "ibp_plugin_destroy"));
+		if (version == nullptr || create == nullptr || destroy == nullptr) {
+			close(library);
+			throw std::runtime_error("Plugin " + name + " does not export the plugin entry points");
+		}
+		if (version() != plugins::AbiVersion) {
+			unsigned found = version();
+			close(library);
+			throw std::runtime_error("Plugin " + name + " was built for plugin ABI " + std::to_string(found)
+				+ ", expected " + std::to_string(plugins::AbiVersion));
+		}
+
+		plugin.library = library;
+		plugin.create = create;
+		plugin.destroy = destroy;
+	}
+
+public:
+	explicit PluginLoader(const std::string& directory) : m_directory(directory) {
+		scan();
+	}
+
+	~PluginLoader() {
+		for (auto& entry : m_plugins) {
+			unload(entry.second);
+		}
+	}
+
+	PluginLoader(const PluginLoader&) = delete;
+	PluginLoader& operator=(const PluginLoader&) = delete;
+
+	std::vector<std::string> getPlugins() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<std::string> names;
+		for (const auto& entry : m_plugins) {
+			names.push_back(entry.first);
+		}
+		return names;
+	}
+
+	bool isLoaded(const std::string& name) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_plugins.find(name);
+		return it != m_plugins.end() && it->second.library != nullptr;
+	}
+
+	// Destroys every instance the plugin created, which must no longer be in use, and
+	// unloads it. Does nothing if the plugin is not loaded.
+	void unload(const std::string& name) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_plugins.find(name);
+		if (it == m_plugins.end()) {
+			throw std::invalid_argument("No plugin named " + name + " in " + m_directory);
+		}
+		unload(it->second);
+	}
+
+	// The plugin's implementation of Interface, owned by the loader, or null if the
+	// plugin does not implement it. Throws if there is no such plugin or it cannot be loaded.
+	template <typename Interface>
+	Interface* get(const std::string& name) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_plugins.find(name);
+		if (it == m_plugins.end()) {
+			throw std::invalid_argument("No plugin named " + name + " in " + m_directory);
+		}
+
+		Plugin& plugin = it->second;
+		const std::string interfaceName(Interface::interfaceName());
+		auto instance = plugin.instances.find(interfaceName);
+		if (instance != plugin.instances.end()) {
+			return static_cast<Interface*>(instance->second);
+		}
+
+		if (plugin.library == nullptr) {
+			open(name, plugin);
+		}
+		void* created = plugin.create(interfaceName.c_str());
+		plugin.instances[interfaceName] = created;
+		return static_cast<Interface*>(created);
+	}
+};
+
+// An interface published by the application for plugins to implement
+class Greeter {
+public:
+	static const char* interfaceName() {
+		return "Greeter/1";
+	}
+
+	virtual std::string greet(const std::string& name) const = 0;
+	virtual ~Greeter() = default;
+};
+
+void ibp_plugins(const std::string& directory = "plugins") {
+	PluginLoader loader(directory);
+	std::vector<std::string> names = loader.getPlugins();
+	std::cout << names.size() << " plugins found in " << directory << std::endl;
+
+	for (const std::string& name : names) {
+		try {
+			Greeter* greeter = loader.get<Greeter>(name);
+			if (greeter != nullptr) {
+				std::cout << name << ": " << greeter->greet("plugin loader") << std::endl;
+			}
+			else {
+				std::cout << name << " does not implement " << Greeter::interfaceName() << std::endl;
+			}
+
+			loader.unload(name); // greeter is gone with it
+			std::cout << name << " is " << (loader.isLoaded(name) ? "still" : "no longer") << " loaded" << std::endl;
+		}
+		catch (const std::exception& e) {
+			std::cout << e.what() << std::endl;
+		}
+	}
+}
+
+// Checks loading, caching, unloading and the ABI check against the example plugins,
+// which must have been built into directory
+void ibp_plugins_check(const std::string& directory = "plugins") {
+	auto require = [](bool condition, const char* what) {
+		if (!condition) {
+			throw std::logic_error(std::string("Plugin loader check failed: ") + what);
+		}
+	};
+
+	PluginLoader loader(directory);
+	std::vector<std::string> names = loader.getPlugins();
+	for (const char* name : { "english_greeter", "stale_greeter" }) {
+		if (std::find(names.begin(), names.end(), name) == names.end()) {
+			throw std::runtime_error(std::string("Build plugin ") + name + " into " + directory + " first");
+		}
+	}
+
+	require(!loader.isLoaded("english_greeter"), "a plugin was opened before it was asked for");
+	Greeter* greeter = loader.get<Greeter>("english_greeter");
+	require(greeter != nullptr && loader.isLoaded("english_greeter"), "the plugin was not loaded");
+	require(greeter->greet("check") == "Hello check", "the plugin greeted wrongly");
+	require(loader.get<Greeter>("english_greeter") == greeter, "a second lookup did not return the cached instance");
+
+	loader.unload("english_greeter");
+	require(!loader.isLoaded("english_greeter"), "the plugin was not unloaded");
+	require(loader.get<Greeter>("english_greeter") != nullptr, "the plugin could not be loaded again");
+
+	bool refused = false;
+	try {
+		loader.get<Greeter>("stale_greeter");
+	}
+	catch (const std::runtime_error& e) {
+		refused = std::string(e.what()).find("plugin ABI") != std::string::npos;
+	}
+	require(refused && !loader.isLoaded("stale_greeter"), "a plugin built for another ABI was accepted");
+
+	std::cout << "Plugin loader checks passed" << std::endl;
+}
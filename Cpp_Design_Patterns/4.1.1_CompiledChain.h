@@ -0,0 +1,349 @@
+#pragma once
+
+/* A compiled chain of threshold handlers
+
+A request to a chain of SpecialHandler objects visits the handlers one by one, with
+a virtual call and a comparison per handler, until one has a limit above the value:
+O(n) in the length of the chain, and one stack frame per handler visited.
+
+The answer only depends on the limits, so the chain can be compiled into a sorted
+table. A handler is only ever reached by values at or above the limits of all the
+handlers before it, so it handles exactly the values in
+
+	[highest limit before it, its own limit)
+
+Handlers whose limit is not above every limit before them can never handle anything
+and are left out; the limits of the others increase along the chain. Routing a value
+is then finding the first limit above it, a binary search written without branches
+(the result of each comparison is used as a number, not a condition) so that
+unpredictable values do not cost branch mispredictions: O(log n) with no recursion.
+
+A batch of values is routed in one pass. Each value is given the index of its handler,
+either by binary search or, for short tables, by counting the limits at or below it:
+the limits are compared against a block of values at a time, a loop the compiler
+turns into SIMD compares. A counting sort then groups the values by handler, keeping
+their order, and each handler's handleBatch() is called once with its slice. Values
+no handler can handle go to the last handler, whose request() turns them down.
+
+The compiled chain refers to the original handlers, which must outlive it, and has to
+be compiled again after the chain is changed. Only chains made entirely of
+SpecialHandler objects can be compiled. Subclasses may do what they like in request()
+and handleBatch(), which the compiled chain calls, but routing goes by the limits
+alone, so any canHandle() they override must still accept exactly the values below
+their limit. Routing a batch uses buffers kept by the
+compiled chain, so one compiled chain must not route batches on two threads at once. */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <cstdint>
+
+#include "4.1_ChainOfResponsibility.h"
+
+class CompiledChain {
+	std::vector<int> m_limits; // strictly increasing
+	std::vector<SpecialHandler*> m_handlers;
+	SpecialHandler* m_last; // reports unhandled requests
+
+	// Reused by batches
+	std::vector<std::uint32_t> m_indices;
+	std::vector<size_t> m_offsets;
+	std::vector<int> m_grouped;
+
+	// Up to this many limits, counting them beats a binary search
+	static const size_t CountingLimits = 32;
+	static const size_t BlockSize = 256;
+
+	// Number of limits <= value, the index of the handler for value
+	size_t indexOf(int value) const {
+		size_t length = m_limits.size();
+		const int* base = m_limits.data();
+		// Invariant: every limit before base is <= value, the answer lies in [base, base + length]
+		while (length > 1) {
+			size_t half = length / 2;
+			base += static_cast<size_t>(base[half - 1] <= value) * half;
+			length -= half;
+		}
+		return static_cast<size_t>(base - m_limits.data()) + (length == 1 && *base <= value ? 1 : 0);
+	}
+
+	void index(const int* values, size_t count) {
+		std::uint32_t* indices = m_indices.data();
+		if (m_limits.size() > CountingLimits) {
+			for (size_t i = 0; i < count; ++i) {
+				indices[i] = static_cast<std::uint32_t>(indexOf(values[i]));
+			}
+			return;
+		}
+		for (size_t block = 0; block < count; block += BlockSize) {
+			const size_t end = std::min(count, block + BlockSize);
+			for (size_t i = block; i < end; ++i) {
+				indices[i] = 0;
+			}
+			for (int limit : m_limits) {
+				for (size_t i = block; i < end; ++i) {
+					indices[i] += static_cast<std::uint32_t>(values[i] >= limit);
+				}
+			}
+		}
+	}
+
+public:
+	explicit CompiledChain(Handler& chain) : m_last(nullptr) {
+		int reached = std::numeric_limits<int>::min(); // values below this were handled earlier in the chain
+		bool first = true;
+		for (Handler* handler = &chain; handler != nullptr; handler = handler->getNextHandler()) {
+			SpecialHandler* special = dynamic_cast<SpecialHandler*>(handler);
+			if (special == nullptr) {
+				throw std::invalid_argument("Only chains of threshold handlers can be compiled");
+			}
+			if (first || special->getLimit() > reached) {
+				m_limits.push_back(special->getLimit());
+				m_handlers.push_back(special);
+				reached = special->getLimit();
+				first = false;
+			}
+			m_last = special;
+		}
+	}
+
+	// The handler the chain would route value to, or null if none can handle it
+	SpecialHandler* route(int value) const {
+		size_t index = indexOf(value);
+		return index < m_handlers.size() ? m_handlers[index] : nullptr;
+	}
+
+	// Hands value straight to the handler the chain would route it to, or to the last
+	// handler to turn it down
+	void request(int value) const {
+		SpecialHandler* handler = route(value);
+		(handler != nullptr ? handler : m_last)->request(value);
+	}
+
+	// Routes a batch of values, calling handleBatch() once per handler with the values
+	// routed to it, in their original order
+	void request(const int* values, size_t count) {
+		if (m_indices.size() < count) {
+			m_indices.resize(count);
+			m_grouped.resize(count);
+		}
+		index(values, count);
+
+		// Counting sort by handler; the last slot is for values no handler can handle
+		const size_t slots = m_handlers.size() + 1;
+		m_offsets.assign(slots + 1, 0);
+		for (size_t i = 0; i < count; ++i) {
+			++m_offsets[m_indices[i] + 1];
+		}
+		for (size_t slot = 0; slot < slots; ++slot) {
+			m_offsets[slot + 1] += m_offsets[slot];
+		}
+		for (size_t i = 0; i < count; ++i) {
+			m_grouped[m_offsets[m_indices[i]]++] = values[i];
+		}
+
+		// Each offset has moved on to the end of its slot
+		size_t start = 0;
+		for (size_t slot = 0; slot < slots; ++slot) {
+			size_t end = m_offsets[slot];
+			if (end > start) {
+				SpecialHandler* handler = slot < m_handlers.size() ? m_handlers[slot] : m_last;
+				handler->handleBatch(m_grouped.data() + start, end - start);
+			}
+			start = end;
+		}
+	}
+
+	// Handlers that can handle anything at all
+	size_t size() const {
+		return m_limits.size();
+	}
+};
+
+void chain_of_responsibility_compiled() {
+	std::unique_ptr<Handler> h1 = std::make_unique<SpecialHandler>(10, 1);
+	std::unique_ptr<Handler> h2 = std::make_unique<SpecialHandler>(20, 2);
+	std::unique_ptr<Handler> h3 = std::make_unique<SpecialHandler>(5, 3); // shadowed by handler 1
+	std::unique_ptr<Handler> h4 = std::make_unique<SpecialHandler>(30, 4);
+
+	h3->setNextHandler(std::move(h4));
+	h2->setNextHandler(std::move(h3));
+	h1->setNextHandler(std::move(h2));
+
+	CompiledChain compiled(*h1);
+	std::cout << "Compiled 4 handlers into " << compiled.size() << std::endl;
+	for (int value : { 4, 18, 29, 40 }) {
+		h1->request(value);
+		compiled.request(value);
+	}
+}
+
+void chain_of_responsibility_compiled_benchmark() {
+	using Clock = std::chrono::steady_clock;
+	std::mt19937 random(11);
+
+	std::cout << std::setw(10) << "handlers" << std::setw(16) << "linked (ns)" << std::setw(16) << "compiled (ns)" << std::endl;
+
+	for (int handlers = 10; handlers <= 10000; handlers *= 10) {
+		std::unique_ptr<Handler> chain;
+		for (int i = handlers; i > 0; --i) {
+			std::unique_ptr<Handler> handler = std::make_unique<SpecialHandler>(10 * i, i);
+			handler->setNextHandler(std::move(chain));
+			chain = std::move(handler);
+		}
+		CompiledChain compiled(*chain);
+
+		// Some values fall off the end of the chain
+		std::uniform_int_distribution<int> values(0, 10 * handlers + 10);
+		std::vector<int> requests(std::max(1000, 10000000 / handlers));
+		for (int& value : requests) {
+			value = values(random);
+		}
+
+		auto start = Clock::now();
+		size_t linkedChecksum = 0;
+		for (int value : requests) {
+			linkedChecksum += reinterpret_cast<size_t>(chain->route(value));
+		}
+		auto linked = Clock::now() - start;
+
+		start = Clock::now();
+		size_t compiledChecksum = 0;
+		for (int value : requests) {
+			compiledChecksum += reinterpret_cast<size_t>(compiled.route(value));
+		}
+		auto fast = Clock::now() - start;
+
+		if (linkedChecksum != compiledChecksum) {
+			throw std::logic_error("The compiled chain routed differently");
+		}
+
+		auto ns = [&requests](Clock::duration d) {
+			return std::chrono::duration<double, std::nano>(d).count() / static_cast<double>(requests.size());
+		};
+		std::cout << std::setw(10) << handlers << std::setw(16) << ns(linked) << std::setw(16) << ns(fast) << std::endl;
+	}
+}
+
+// A threshold handler that adds up what it handles, taking batches whole
+class SummingHandler : public SpecialHandler {
+	long long m_sum;
+	size_t m_handled;
+	size_t m_refused;
+	size_t m_calls;
+
+public:
+	SummingHandler(int limit, int id) : SpecialHandler(limit, id), m_sum(0), m_handled(0), m_refused(0), m_calls(0) {}
+
+	void request(int value) override {
+		++m_calls;
+		if (canHandle(value)) {
+			m_sum += value;
+			++m_handled;
+		}
+		else if (next != nullptr) {
+			next->request(value);
+		}
+		else {
+			++m_refused;
+		}
+	}
+
+	// A routed batch is either all for this handler or, for the last one, all refused
+	void handleBatch(const int* values, size_t count) override {
+		++m_calls;
+		if (!canHandle(values[0])) {
+			m_refused += count;
+			return;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			m_sum += values[i];
+		}
+		m_handled += count;
+	}
+
+	long long getSum() const {
+		return m_sum;
+	}
+
+	size_t getHandled() const {
+		return m_handled;
+	}
+
+	size_t getRefused() const {
+		return m_refused;
+	}
+
+	size_t getCalls() const {
+		return m_calls;
+	}
+};
+
+void chain_of_responsibility_batch() {
+	std::unique_ptr<Handler> h1 = std::make_unique<SpecialHandler>(10, 1);
+	std::unique_ptr<Handler> h2 = std::make_unique<SpecialHandler>(20, 2);
+	std::unique_ptr<Handler> h3 = std::make_unique<SpecialHandler>(30, 3);
+
+	h2->setNextHandler(std::move(h3));
+	h1->setNextHandler(std::move(h2));
+
+	// Handled in the order 4 7, 18 12, 25, then 40 and 31 are turned down
+	CompiledChain compiled(*h1);
+	const int values[] = { 4, 18, 40, 25, 7, 31, 12 };
+	compiled.request(values, sizeof(values) / sizeof(values[0]));
+}
+
+void chain_of_responsibility_batch_benchmark(size_t count = 10000000) {
+	using Clock = std::chrono::steady_clock;
+	std::mt19937 random(5);
+
+	std::cout << std::setw(10) << "handlers" << std::setw(20) << "one by one (ns)" << std::setw(20) << "batch (ns)" << std::endl;
+
+	for (int handlers : { 4, 16, 64, 1024 }) {
+		// Two identical chains, one for each way of routing
+		std::unique_ptr<Handler> chains[2];
+		std::vector<SummingHandler*> summing[2];
+		for (int c = 0; c < 2; ++c) {
+			for (int i = handlers; i > 0; --i) {
+				std::unique_ptr<SummingHandler> handler = std::make_unique<SummingHandler>(100 * i, i);
+				summing[c].push_back(handler.get());
+				handler->setNextHandler(std::move(chains[c]));
+				chains[c] = std::move(handler);
+			}
+		}
+
+		std::uniform_int_distribution<int> distribution(0, 100 * handlers + 100);
+		std::vector<int> values(count);
+		for (int& value : values) {
+			value = distribution(random);
+		}
+
+		auto start = Clock::now();
+		for (int value : values) {
+			chains[0]->request(value);
+		}
+		auto oneByOne = Clock::now() - start;
+
+		CompiledChain compiled(*chains[1]);
+		start = Clock::now();
+		compiled.request(values.data(), values.size());
+		auto batch = Clock::now() - start;
+
+		for (size_t i = 0; i < summing[0].size(); ++i) {
+			if (summing[0][i]->getSum() != summing[1][i]->getSum() || summing[0][i]->getRefused() != summing[1][i]->getRefused()) {
+				throw std::logic_error("The batch was routed differently");
+			}
+		}
+
+		auto ns = [count](Clock::duration d) {
+			return std::chrono::duration<double, std::nano>(d).count() / static_cast<double>(count);
+		};
+		std::cout << std::setw(10) << handlers << std::setw(20) << ns(oneByOne) << std::setw(20) << ns(batch) << std::endl;
+	}
+}
\ No newline at end of file
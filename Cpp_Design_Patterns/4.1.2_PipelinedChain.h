@@ -0,0 +1,442 @@
+#pragma once
+
+/* A pipelined chain of responsibility
+
+When the handlers of a chain do real work, a request walking the chain keeps one
+core busy while the others sit idle. PipelinedChain runs every handler of a chain
+on its own thread instead: a stage takes requests from its input queue, hands the
+ones its handler can handle to it, and passes the rest on to the next stage's queue,
+so the stages work on different requests at the same time.
+
+- the queues between stages are bounded single-producer/single-consumer rings, lock
+  free; a full queue makes the stage (or caller) before it wait, so a slow stage
+  slows the whole pipeline down instead of letting its queue grow without limit
+- a stage takes up to batchSize requests at a time, and calls handleBatch() once for
+  the requests its handler handles; the last stage hands the requests nobody handled
+  to its handler in the same way, whose request() turns them down
+- each stage counts the requests it processed, handled and passed on and the time it
+  was busy, and reports how full its queue is, so the slowest stage can be found
+
+A stage decides which requests are its handler's by asking canHandle() alone, so
+only chains of SpecialHandler objects, which decide there, can be pipelined; a
+handler deciding in request() would never be given work. Subclasses overriding
+canHandle() must answer as their request() decides.
+
+Each handler is only ever called from its own stage's thread. Requests stay in order
+within a stage, but requests handled by different stages complete in any order. The
+handlers of the chain must outlive the pipeline. */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include "4.1_ChainOfResponsibility.h"
+
+namespace pipeline {
+	const size_t CacheLineSize = 64;
+
+	// Spins first, as the other side is usually about to catch up, then backs off to sleeping
+	inline void backOff(unsigned& attempt) {
+		if (attempt < 64) {
+			std::this_thread::yield();
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+		++attempt;
+	}
+
+	/* A bounded single-producer/single-consumer queue. head and tail only ever
+	increase, and each lives on its own cache line so that the producer and consumer
+	do not invalidate each other's line on every operation. */
+	template <typename T>
+	class SpscQueue {
+		std::atomic<size_t> m_tail; // written by the producer
+		char m_tailPadding[CacheLineSize - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> m_head; // written by the consumer
+		char m_headPadding[CacheLineSize - sizeof(std::atomic<size_t>)];
+		std::vector<T> m_slots;
+		size_t m_mask;
+
+	public:
+		// The capacity is rounded up to a power of two
+		explicit SpscQueue(size_t capacity) : m_tail(0), m_head(0) {
+			size_t size = 1;
+			while (size < capacity) {
+				size *= 2;
+			}
+			m_slots.resize(size);
+			m_mask = size - 1;
+		}
+
+		// Producer: pushes as many values as fit, returns how many
+		size_t tryPush(const T* values, size_t count) {
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			size_t space = m_slots.size() - (tail - m_head.load(std::memory_order_acquire));
+			count = std::min(count, space);
+			for (size_t i = 0; i < count; ++i) {
+				m_slots[(tail + i) & m_mask] = values[i];
+			}
+			m_tail.store(tail + count, std::memory_order_release);
+			return count;
+		}
+
+		// Consumer: pops up to max values, returns how many
+		size_t tryPop(T* values, size_t max) {
+			size_t head = m_head.load(std::memory_order_relaxed);
+			size_t count = std::min(max, m_tail.load(std::memory_order_acquire) - head);
+			for (size_t i = 0; i < count; ++i) {
+				values[i] = m_slots[(head + i) & m_mask];
+			}
+			m_head.store(head + count, std::memory_order_release);
+			return count;
+		}
+
+		// Exact only when called by the producer or the consumer
+		size_t size() const {
+			return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+		}
+
+		size_t capacity() const {
+			return m_slots.size();
+		}
+	};
+}
+
+struct PipelineOptions {
+	size_t queueCapacity;
+	size_t batchSize;
+
+	PipelineOptions(size_t queueCapacity = 4096, size_t batchSize = 64) : queueCapacity(queueCapacity), batchSize(batchSize) {}
+};
+
+struct StageStatistics {
+	size_t processed;
+	size_t handled;
+	size_t forwarded;
+	size_t batches;
+	size_t queueDepth;
+	size_t maxQueueDepth;
+	size_t queueCapacity;
+	double busySeconds;
+
+	// Requests per second of busy time; the stage with the lowest limits the pipeline
+	double getThroughput() const {
+		return busySeconds > 0 ? static_cast<double>(processed) / busySeconds : 0.0;
+	}
+};
+
+class PipelinedChain {
+	struct Stage {
+		Handler* handler;
+		pipeline::SpscQueue<int> input;
+		std::atomic<bool> closed; // no more input will be pushed
+		std::thread thread;
+
+		// Written by the stage's thread only
+		std::atomic<size_t> processed;
+		std::atomic<size_t> handled;
+		std::atomic<size_t> forwarded;
+		std::atomic<size_t> batches;
+		std::atomic<size_t> maxQueueDepth;
+		std::atomic<long long> busyNanoseconds;
+
+		Stage(Handler* handler, size_t capacity) : handler(handler), input(capacity), closed(false),
+			processed(0), handled(0), forwarded(0), batches(0), maxQueueDepth(0), busyNanoseconds(0) {}
+	};
+
+	PipelineOptions m_options;
+	std::vector<std::unique_ptr<Stage> > m_stages;
+	size_t m_submitted;
+	std::atomic<size_t> m_completed; // handled anywhere, or turned down by the last stage
+	bool m_finished;
+
+	// Blocks while the queue is full: this is the backpressure
+	static void push(Stage& stage, const int* values, size_t count) {
+		unsigned attempt = 0;
+		while (count > 0) {
+			size_t pushed = stage.input.tryPush(values, count);
+			values += pushed;
+			count -= pushed;
+			if (count > 0) {
+				pipeline::backOff(attempt);
+			}
+		}
+	}
+
+	void run(size_t index) {
+		using Clock = std::chrono::steady_clock;
+		Stage& stage = *m_stages[index];
+		Stage* next = index + 1 < m_stages.size() ? m_stages[index + 1].get() : nullptr;
+		std::vector<int> batch(m_options.batchSize), mine, others;
+		mine.reserve(m_options.batchSize);
+		others.reserve(m_options.batchSize);
+
+		unsigned attempt = 0;
+		for (;;) {
+			size_t depth = stage.input.size();
+			size_t count = stage.input.tryPop(batch.data(), batch.size());
+			if (count == 0) {
+				// Check closed before looking again, so that a value pushed just before closing is not missed
+				if (stage.closed.load(std::memory_order_acquire) && stage.input.size() == 0) {
+					break;
+				}
+				pipeline::backOff(attempt);
+				continue;
+			}
+			attempt = 0;
+			if (depth > stage.maxQueueDepth.load(std::memory_order_relaxed)) {
+				stage.maxQueueDepth.store(depth, std::memory_order_relaxed);
+			}
+
+			auto start = Clock::now();
+			mine.clear();
+			others.clear();
+			for (size_t i = 0; i < count; ++i) {
+				(stage.handler->canHandle(batch[i]) ? mine : others).push_back(batch[i]);
+			}
+			if (!mine.empty()) {
+				stage.handler->handleBatch(mine.data(), mine.size());
+			}
+			if (next == nullptr && !others.empty()) {
+				stage.handler->handleBatch(others.data(), others.size()); // turned down
+			}
+			auto busy = Clock::now() - start;
+
+			stage.processed.store(stage.processed.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+			stage.handled.store(stage.handled.load(std::memory_order_relaxed) + mine.size(), std::memory_order_relaxed);
+			stage.batches.store(stage.batches.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			stage.busyNanoseconds.store(stage.busyNanoseconds.load(std::memory_order_relaxed)
+				+ std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(), std::memory_order_relaxed);
+
+			if (next != nullptr) {
+				push(*next, others.data(), others.size());
+				stage.forwarded.store(stage.forwarded.load(std::memory_order_relaxed) + others.size(), std::memory_order_relaxed);
+				m_completed.fetch_add(mine.size(), std::memory_order_release);
+			}
+			else {
+				m_completed.fetch_add(count, std::memory_order_release);
+			}
+		}
+
+		if (next != nullptr) {
+			next->closed.store(true, std::memory_order_release);
+		}
+	}
+
+public:
+	explicit PipelinedChain(Handler& chain, const PipelineOptions& options = PipelineOptions())
+		: m_options(options), m_submitted(0), m_completed(0), m_finished(false) {
+		if (m_options.batchSize == 0 || m_options.queueCapacity == 0) {
+			throw std::invalid_argument("The batch size and queue capacity must be positive");
+		}
+		for (Handler* handler = &chain; handler != nullptr; handler = handler->getNextHandler()) {
+			if (dynamic_cast<SpecialHandler*>(handler) == nullptr) {
+				throw std::invalid_argument("Only chains of threshold handlers can be pipelined");
+			}
+			m_stages.emplace_back(new Stage(handler, m_options.queueCapacity));
+		}
+		for (size_t i = 0; i < m_stages.size(); ++i) {
+			m_stages[i]->thread = std::thread(&PipelinedChain::run, this, i);
+		}
+	}
+
+	~PipelinedChain() {
+		finish();
+	}
+
+	PipelinedChain(const PipelinedChain&) = delete;
+	PipelinedChain& operator=(const PipelinedChain&) = delete;
+
+	// Submits requests, waiting while the first stage's queue is full. Not thread safe:
+	// the pipeline has a single producer.
+	void request(const int* values, size_t count) {
+		if (m_finished) {
+			throw std::logic_error("The pipeline has finished");
+		}
+		push(*m_stages.front(), values, count);
+		m_submitted += count;
+	}
+
+	void request(int value) {
+		request(&value, 1);
+	}
+
+	// Submits a request unless the first stage's queue is full
+	bool tryRequest(int value) {
+		if (m_finished) {
+			throw std::logic_error("The pipeline has finished");
+		}
+		if (m_stages.front()->input.tryPush(&value, 1) == 0) {
+			return false;
+		}
+		++m_submitted;
+		return true;
+	}
+
+	// Waits until every request submitted so far has been handled or turned down
+	void drain() {
+		unsigned attempt = 0;
+		while (m_completed.load(std::memory_order_acquire) < m_submitted) {
+			pipeline::backOff(attempt);
+		}
+	}
+
+	// Lets the stages finish what they have and stops their threads
+	void finish() {
+		if (m_finished) {
+			return;
+		}
+		m_finished = true;
+		m_stages.front()->closed.store(true, std::memory_order_release);
+		for (std::unique_ptr<Stage>& stage : m_stages) {
+			stage->thread.join();
+		}
+	}
+
+	std::vector<StageStatistics> getStatistics() const {
+		std::vector<StageStatistics> statistics;
+		for (const std::unique_ptr<Stage>& stage : m_stages) {
+			statistics.push_back(StageStatistics{
+				stage->processed.load(std::memory_order_relaxed),
+				stage->handled.load(std::memory_order_relaxed),
+				stage->forwarded.load(std::memory_order_relaxed),
+				stage->batches.load(std::memory_order_relaxed),
+				stage->input.size(),
+				stage->maxQueueDepth.load(std::memory_order_relaxed),
+				stage->input.capacity(),
+				static_cast<double>(stage->busyNanoseconds.load(std::memory_order_relaxed)) / 1e9 });
+		}
+		return statistics;
+	}
+
+	void report(std::ostream& out) const {
+		std::vector<StageStatistics> statistics = getStatistics();
+		for (size_t i = 0; i < statistics.size(); ++i) {
+			const StageStatistics& stage = statistics[i];
+			out << "Stage " << i << ": " << stage.processed << " processed, " << stage.handled << " handled, "
+				<< stage.forwarded << " passed on in " << stage.batches << " batches, queue " << stage.queueDepth
+				<< "/" << stage.queueCapacity << " (max " << stage.maxQueueDepth << "), "
+				<< static_cast<long long>(stage.getThroughput()) << " requests/s busy" << std::endl;
+		}
+	}
+};
+
+// A threshold handler whose decision takes real work, e.g. validating the request
+class WorkingHandler : public SpecialHandler {
+	unsigned m_work;
+	mutable unsigned m_checksum; // keeps the compiler from skipping the work
+	long long m_sum;
+	size_t m_refused;
+
+public:
+	WorkingHandler(int limit, int id, unsigned work) : SpecialHandler(limit, id), m_work(work), m_checksum(0), m_sum(0), m_refused(0) {}
+
+	bool canHandle(int value) const override {
+		unsigned x = static_cast<unsigned>(value);
+		for (unsigned i = 0; i < m_work; ++i) {
+			x = x * 1664525u + 1013904223u;
+		}
+		m_checksum += x;
+		return SpecialHandler::canHandle(value);
+	}
+
+	void request(int value) override {
+		if (canHandle(value)) {
+			m_sum += value;
+		}
+		else if (next != nullptr) {
+			next->request(value);
+		}
+		else {
+			++m_refused;
+		}
+	}
+
+	// The pipeline only passes a stage the requests it can handle, and the last stage
+	// those nobody handled
+	void handleBatch(const int* values, size_t count) override {
+		if (!SpecialHandler::canHandle(values[0])) {
+			m_refused += count;
+			return;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			m_sum += values[i];
+		}
+	}
+
+	long long getSum() const {
+		return m_sum;
+	}
+
+	size_t getRefused() const {
+		return m_refused;
+	}
+};
+
+void chain_of_responsibility_pipelined() {
+	std::unique_ptr<Handler> h1 = std::make_unique<WorkingHandler>(10, 1, 100);
+	std::unique_ptr<Handler> h2 = std::make_unique<WorkingHandler>(20, 2, 100);
+	std::unique_ptr<Handler> h3 = std::make_unique<WorkingHandler>(30, 3, 100);
+	WorkingHandler* last = static_cast<WorkingHandler*>(h3.get());
+
+	h2->setNextHandler(std::move(h3));
+	h1->setNextHandler(std::move(h2));
+
+	{
+		PipelinedChain pipeline(*h1, PipelineOptions(256, 32));
+		for (int i = 0; i < 100000; ++i) {
+			pipeline.request(i % 40);
+		}
+		pipeline.drain();
+		pipeline.report(std::cout);
+	}
+	std::cout << "Turned down " << last->getRefused() << " requests" << std::endl;
+}
+
+void chain_of_responsibility_pipelined_benchmark(int requests = 2000000) {
+	using Clock = std::chrono::steady_clock;
+	const int stages = static_cast<int>(std::max(2u, std::min(8u, std::thread::hardware_concurrency())));
+
+	auto makeChain = [stages]() {
+		std::unique_ptr<Handler> chain;
+		for (int i = stages; i > 0; --i) {
+			std::unique_ptr<Handler> handler = std::make_unique<WorkingHandler>(100 * i, i, 200);
+			handler->setNextHandler(std::move(chain));
+			chain = std::move(handler);
+		}
+		return chain;
+	};
+
+	std::vector<int> values(static_cast<size_t>(requests));
+	for (size_t i = 0; i < values.size(); ++i) {
+		values[i] = static_cast<int>(i * 7919 % static_cast<size_t>(100 * stages + 100));
+	}
+
+	std::unique_ptr<Handler> sequential = makeChain();
+	auto start = Clock::now();
+	for (int value : values) {
+		sequential->request(value);
+	}
+	double sequentialSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::unique_ptr<Handler> pipelined = makeChain();
+	start = Clock::now();
+	{
+		PipelinedChain pipeline(*pipelined);
+		pipeline.request(values.data(), values.size());
+		pipeline.drain();
+		double pipelinedSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::cout << stages << " stages, " << requests << " requests" << std::endl
+			<< "Sequential chain: " << static_cast<long long>(requests / sequentialSeconds) << " requests/s" << std::endl
+			<< "Pipelined chain: " << static_cast<long long>(requests / pipelinedSeconds) << " requests/s" << std::endl;
+		pipeline.report(std::cout);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,250 @@
+#pragma once
+
+/* A self-optimizing chain of responsibility
+
+The handlers of a threshold chain must stay in order, but when each handler tests an
+independent predicate (at most one of them accepts any given request) the order only
+decides how many handlers a request passes before it is handled. It is best to ask
+the handler that takes most requests first, and that is only known at run time.
+
+AdaptiveChain keeps, for each handler, how many requests it handled and, for a
+sample of them, how long it took, and for the chain the number of handlers asked per
+request. In adaptive mode it reorders the handlers every so many requests by how
+many requests each handled since the last reordering, most first.
+
+Requests may come from any number of threads while the chain is reordered. The order
+is an array of handler pointers guarded by a sequence number, which a reordering
+makes odd while it rewrites the array and even again after. A request walking the
+array while it is rewritten can see a handler twice or miss one. Seeing one twice
+is harmless, and since any handler that accepts a request is the right one, a
+request that found its handler is done; only a request that found none checks the
+sequence number, and asks again if the order changed under it. Requests never wait
+for a reordering.
+
+Handlers are called from the threads making requests, so they must be thread safe,
+and AdaptiveChain owns them. The handlers' own next pointers are not used. */
+
+#include <iostream>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <random>
+
+#include "4.1_ChainOfResponsibility.h"
+
+class AdaptiveChain {
+	struct Entry {
+		std::unique_ptr<Handler> handler;
+		std::string name;
+		std::atomic<std::uint64_t> hits;
+		std::atomic<std::uint64_t> sampledNanoseconds; // time spent handling, in sampled requests
+		std::uint64_t hitsAtLastReorder; // guarded by m_reorderMutex
+
+		Entry(std::unique_ptr<Handler>&& handler, const std::string& name) :
+			handler(std::move(handler)), name(name), hits(0), sampledNanoseconds(0), hitsAtLastReorder(0) {}
+	};
+
+	static const std::uint64_t LatencySampling = 16; // time one hit in this many
+
+	std::vector<std::unique_ptr<Entry> > m_entries;
+	std::unique_ptr<std::atomic<Entry*>[]> m_order;
+	size_t m_size;
+
+	std::atomic<unsigned> m_sequence; // odd while the order is being rewritten
+	std::mutex m_reorderMutex;
+
+	std::atomic<std::uint64_t> m_requests;
+	std::atomic<std::uint64_t> m_unhandled;
+	std::atomic<std::uint64_t> m_depth; // handlers asked, over all requests
+	std::atomic<std::uint64_t> m_reorders;
+	std::atomic<std::uint64_t> m_interval; // requests between reorderings, 0 when not adaptive
+
+public:
+	AdaptiveChain() : m_size(0), m_sequence(0), m_requests(0), m_unhandled(0), m_depth(0), m_reorders(0), m_interval(0) {}
+
+	AdaptiveChain(const AdaptiveChain&) = delete;
+	AdaptiveChain& operator=(const AdaptiveChain&) = delete;
+
+	// Handlers are asked in the order they are added until the chain is reordered.
+	// Adding handlers is not thread safe; add them all before making requests.
+	void addHandler(std::unique_ptr<Handler> handler, const std::string& name) {
+		m_entries.emplace_back(new Entry(std::move(handler), name));
+		m_size = m_entries.size();
+		m_order.reset(new std::atomic<Entry*>[m_size]);
+		for (size_t i = 0; i < m_size; ++i) {
+			m_order[i].store(m_entries[i].get(), std::memory_order_relaxed);
+		}
+	}
+
+	// Reorders every interval requests; 0 keeps the current order
+	void setAdaptive(std::uint64_t interval) {
+		m_interval.store(interval, std::memory_order_relaxed);
+	}
+
+	// Returns whether a handler took the request
+	bool request(int value) {
+		Entry* handledBy = nullptr;
+		std::uint64_t depth = 0;
+		for (;;) {
+			unsigned sequence = m_sequence.load(std::memory_order_acquire);
+			for (size_t i = 0; i < m_size && handledBy == nullptr; ++i) {
+				Entry* entry = m_order[i].load(std::memory_order_acquire);
+				++depth;
+				if (entry->handler->canHandle(value)) {
+					handledBy = entry;
+				}
+			}
+			if (handledBy != nullptr) {
+				break;
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (sequence % 2 == 0 && m_sequence.load(std::memory_order_relaxed) == sequence) {
+				break; // the order did not change while it was walked: nobody takes this request
+			}
+		}
+
+		if (handledBy != nullptr) {
+			std::uint64_t hit = handledBy->hits.fetch_add(1, std::memory_order_relaxed);
+			if (hit % LatencySampling == 0) {
+				auto start = std::chrono::steady_clock::now();
+				handledBy->handler->request(value);
+				auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+				handledBy->sampledNanoseconds.fetch_add(static_cast<std::uint64_t>(elapsed.count()), std::memory_order_relaxed);
+			}
+			else {
+				handledBy->handler->request(value);
+			}
+		}
+		else {
+			m_unhandled.fetch_add(1, std::memory_order_relaxed);
+		}
+		m_depth.fetch_add(depth, std::memory_order_relaxed);
+
+		std::uint64_t requests = m_requests.fetch_add(1, std::memory_order_relaxed) + 1;
+		std::uint64_t interval = m_interval.load(std::memory_order_relaxed);
+		if (interval != 0 && requests % interval == 0) {
+			reorder();
+		}
+		return handledBy != nullptr;
+	}
+
+	// Puts the handlers that handled most requests since the last reordering first. A
+	// reordering already under way on another thread makes this one unnecessary.
+	void reorder() {
+		std::unique_lock<std::mutex> lock(m_reorderMutex, std::try_to_lock);
+		if (!lock.owns_lock()) {
+			return;
+		}
+
+		std::vector<std::pair<std::uint64_t, Entry*> > recent;
+		for (size_t i = 0; i < m_size; ++i) {
+			Entry* entry = m_order[i].load(std::memory_order_relaxed);
+			std::uint64_t hits = entry->hits.load(std::memory_order_relaxed);
+			recent.emplace_back(hits - entry->hitsAtLastReorder, entry);
+			entry->hitsAtLastReorder = hits;
+		}
+		// Stable, so that handlers doing equally well keep their relative order
+		std::stable_sort(recent.begin(), recent.end(), [](const std::pair<std::uint64_t, Entry*>& a, const std::pair<std::uint64_t, Entry*>& b) {
+			return a.first > b.first;
+		});
+
+		m_sequence.fetch_add(1, std::memory_order_relaxed); // odd
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < m_size; ++i) {
+			m_order[i].store(recent[i].second, std::memory_order_relaxed);
+		}
+		m_sequence.fetch_add(1, std::memory_order_release); // even
+		m_reorders.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Handlers asked per request, on average
+	double getAverageDepth() const {
+		std::uint64_t requests = m_requests.load(std::memory_order_relaxed);
+		return requests == 0 ? 0.0 : static_cast<double>(m_depth.load(std::memory_order_relaxed)) / static_cast<double>(requests);
+	}
+
+	void report(std::ostream& out) const {
+		std::uint64_t requests = m_requests.load(std::memory_order_relaxed);
+		out << requests << " requests, " << m_unhandled.load(std::memory_order_relaxed) << " unhandled, "
+			<< getAverageDepth() << " handlers asked per request, " << m_reorders.load(std::memory_order_relaxed) << " reorderings" << std::endl;
+		for (size_t i = 0; i < m_size; ++i) {
+			const Entry* entry = m_order[i].load(std::memory_order_acquire);
+			std::uint64_t hits = entry->hits.load(std::memory_order_relaxed);
+			std::uint64_t samples = (hits + LatencySampling - 1) / LatencySampling;
+			out << "\t" << i << ": " << entry->name << ", " << hits << " hits ("
+				<< (requests == 0 ? 0.0 : 100.0 * static_cast<double>(hits) / static_cast<double>(requests)) << "%), ";
+			if (samples != 0) {
+				out << static_cast<double>(entry->sampledNanoseconds.load(std::memory_order_relaxed)) / static_cast<double>(samples) << " ns per request";
+			}
+			else {
+				out << "no latency samples";
+			}
+			out << std::endl;
+		}
+	}
+};
+
+// A handler for the requests that satisfy a predicate
+class PredicateHandler : public Handler {
+	std::function<bool(int)> m_predicate;
+	std::atomic<std::uint64_t> m_handled;
+
+public:
+	explicit PredicateHandler(const std::function<bool(int)>& predicate) : m_predicate(predicate), m_handled(0) {}
+
+	bool canHandle(int value) const override {
+		return m_predicate(value);
+	}
+
+	void request(int value) override {
+		if (canHandle(value)) {
+			m_handled.fetch_add(1, std::memory_order_relaxed);
+		}
+		else if (next != nullptr) {
+			next->request(value);
+		}
+	}
+
+	std::uint64_t getHandled() const {
+		return m_handled.load(std::memory_order_relaxed);
+	}
+};
+
+void chain_of_responsibility_adaptive() {
+	for (bool adaptive : { false, true }) {
+		AdaptiveChain chain;
+		chain.addHandler(std::make_unique<PredicateHandler>([](int v) { return v < 0; }), "negative");
+		chain.addHandler(std::make_unique<PredicateHandler>([](int v) { return v >= 0 && v < 10; }), "single digit");
+		chain.addHandler(std::make_unique<PredicateHandler>([](int v) { return v >= 10 && v < 1000; }), "up to 999");
+		chain.addHandler(std::make_unique<PredicateHandler>([](int v) { return v >= 1000 && v % 2 == 0; }), "large and even");
+		chain.addHandler(std::make_unique<PredicateHandler>([](int v) { return v >= 1000 && v % 2 != 0; }), "large and odd");
+		if (adaptive) {
+			chain.setAdaptive(10000);
+		}
+
+		// Most requests are large, which the handlers asked last deal with
+		std::vector<std::thread> threads;
+		for (unsigned t = 0; t < 4; ++t) {
+			threads.emplace_back([&chain, t]() {
+				std::mt19937 random(t);
+				std::uniform_int_distribution<int> large(1000, 1000000), small(-1000, 999);
+				for (int i = 0; i < 100000; ++i) {
+					chain.request(random() % 10 < 9 ? large(random) : small(random));
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+
+		std::cout << (adaptive ? "Adaptive" : "Fixed") << " order: ";
+		chain.report(std::cout);
+	}
+}
\ No newline at end of file
@@ -20,13 +20,49 @@ protected:
 public:
 	Handler() : next(nullptr) {};
 	
-	virtual ~Handler() {}
+	// Unlinks the rest of the chain one handler at a time, so that destroying a long
+	// chain does not recurse as deep as the chain is long
+	virtual ~Handler() {
+		while (next != nullptr) {
+			next = std::move(next->next);
+		}
+	}
 
 	virtual void request(int value) = 0; // Pure virtual
 
+	// Whether this handler, rather than the next in line, handles value. Handlers that
+	// decide in request() alone need not say; route() then never picks them.
+	virtual bool canHandle(int) const {
+		return false;
+	}
+
+	// Handles a batch of values that were all routed to this handler
+	virtual void handleBatch(const int* values, size_t count) {
+		for (size_t i = 0; i < count; ++i) {
+			request(values[i]);
+		}
+	}
+
 	void setNextHandler(std::unique_ptr<Handler>&& nextInLine) {
 		next = std::move(nextInLine);
 	}
+
+	Handler* getNextHandler() {
+		return next.get();
+	}
+
+	const Handler* getNextHandler() const {
+		return next.get();
+	}
+
+	// The handler in this chain that request(value) ends up with, or null if none can handle it
+	const Handler* route(int value) const {
+		const Handler* handler = this;
+		while (handler != nullptr && !handler->canHandle(value)) {
+			handler = handler->next.get();
+		}
+		return handler;
+	}
 };
 
 // Concrete
@@ -42,8 +78,20 @@ public:
 
 	~SpecialHandler() {}
 
+	int getLimit() const {
+		return myLimit;
+	}
+
+	int getId() const {
+		return myId;
+	}
+
+	bool canHandle(int value) const override {
+		return value < myLimit;
+	}
+
 	void request(int value) {
-		if (value < myLimit) {
+		if (canHandle(value)) {
 			std::cout << "Handler " << myId << " handled the request with a limit of " << myLimit << std::endl;
 		}
 		else if (next != nullptr) {
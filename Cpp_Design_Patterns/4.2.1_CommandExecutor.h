@@ -0,0 +1,450 @@
+#pragma once
+
+/* A command executor
+
+Commands decouple asking for a request from carrying it out, so they need not be
+carried out by the thread that asks, or right away. CommandExecutor takes commands
+from any number of threads and executes them on a pool of worker threads, returning
+a future that becomes ready when the command has been executed (or holds whatever
+exception execute() threw).
+
+- each worker has its own queue of tasks, taking the newest first while its cache is
+  still warm with it; a worker whose queue is empty steals the oldest task from
+  another worker's queue, so an uneven load evens itself out. Each queue has its own
+  lock, which only thieves and submitting threads contend for
+- commands submitted for a receiver (e.g. a Light) are executed one at a time, in the
+  order they were submitted. Each receiver with commands waiting has a strand, a
+  queue of its commands which is scheduled on the pool as a single task: the worker
+  running it executes a few of its commands and schedules it again if there are
+  more, so that no two workers ever execute commands for the same receiver at once
+- commands submitted without a receiver are scheduled on their own and may be
+  executed in any order, at the same time as any other command
+- idle workers sleep and are woken as work is submitted
+
+The executor owns the commands, and the receivers must outlive them. drain() waits
+until every command submitted so far has been executed; the destructor drains the
+executor before stopping the workers. Commands must not call drain(). */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <cstdint>
+
+#include "4.2_Command.h"
+
+class CommandExecutor {
+	static const size_t CacheLineSize = 64;
+	static const size_t StrandBatch = 32; // commands a strand executes before letting others run
+	static const size_t ShardCount = 64;
+
+	struct Job {
+		std::unique_ptr<Command> command;
+		std::promise<void> done;
+	};
+
+	// The commands waiting for one receiver
+	struct Strand {
+		const void* receiver;
+		std::mutex mutex;
+		std::deque<Job> jobs;
+		bool scheduled; // on a worker's queue or running
+
+		explicit Strand(const void* receiver) : receiver(receiver), scheduled(false) {}
+	};
+
+	// Either a strand to run or a command without a receiver
+	struct Task {
+		std::shared_ptr<Strand> strand;
+		Job job;
+	};
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		char padding[CacheLineSize];
+	};
+
+	// The strands of receivers with commands waiting, spread over shards to keep submitting threads apart
+	struct Shard {
+		std::mutex mutex;
+		std::unordered_map<const void*, std::shared_ptr<Strand> > strands;
+		char padding[CacheLineSize];
+	};
+
+	std::unique_ptr<Worker[]> m_workers;
+	size_t m_workerCount;
+	std::vector<std::thread> m_threads;
+	std::unique_ptr<Shard[]> m_shards;
+
+	std::atomic<size_t> m_pending; // tasks on the workers' queues
+	std::atomic<size_t> m_sleeping;
+	std::atomic<size_t> m_nextWorker; // where the next task from outside the pool goes
+	std::mutex m_idleMutex;
+	std::condition_variable m_wake;
+	bool m_stopping; // guarded by m_idleMutex
+
+	std::atomic<size_t> m_outstanding; // commands submitted and not yet executed
+	std::mutex m_drainMutex;
+	std::condition_variable m_drained;
+
+	std::atomic<std::uint64_t> m_executed;
+	std::atomic<std::uint64_t> m_stolen;
+
+	// The executor and worker the calling thread belongs to, if any
+	struct CurrentWorker {
+		const CommandExecutor* executor;
+		size_t index;
+	};
+
+	static CurrentWorker& currentWorker() {
+		static thread_local CurrentWorker current = { nullptr, 0 };
+		return current;
+	}
+
+	Shard& shardOf(const void* receiver) {
+		return m_shards[(reinterpret_cast<std::uintptr_t>(receiver) >> 4) % ShardCount];
+	}
+
+	// A task scheduled for later goes behind the others of the worker's queue, where thieves look first
+	void schedule(Task&& task, bool later = false) {
+		// Workers keep the tasks they create; other threads spread theirs around
+		const CurrentWorker& current = currentWorker();
+		size_t index = current.executor == this ? current.index : m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workerCount;
+
+		m_pending.fetch_add(1);
+		{
+			std::lock_guard<std::mutex> lock(m_workers[index].mutex);
+			if (later) {
+				m_workers[index].tasks.push_front(std::move(task));
+			}
+			else {
+				m_workers[index].tasks.push_back(std::move(task));
+			}
+		}
+		if (m_sleeping.load() > 0) {
+			std::lock_guard<std::mutex> lock(m_idleMutex);
+			m_wake.notify_one();
+		}
+	}
+
+	bool take(size_t index, Task& task) {
+		{
+			Worker& own = m_workers[index];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty()) {
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				m_pending.fetch_sub(1);
+				return true;
+			}
+		}
+		for (size_t k = 1; k < m_workerCount; ++k) {
+			Worker& victim = m_workers[(index + k) % m_workerCount];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()) {
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				m_pending.fetch_sub(1);
+				m_stolen.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void execute(Job& job) {
+		std::exception_ptr error;
+		try {
+			job.command->execute();
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+		// Counted and destroyed before anyone waiting for the command is told it is done
+		job.command.reset();
+		m_executed.fetch_add(1, std::memory_order_relaxed);
+		if (error != nullptr) {
+			job.done.set_exception(error);
+		}
+		else {
+			job.done.set_value();
+		}
+		if (m_outstanding.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> lock(m_drainMutex);
+			m_drained.notify_all();
+		}
+	}
+
+	// Marks an idle strand as no longer scheduled and forgets it, unless commands arrived meanwhile
+	bool retire(const std::shared_ptr<Strand>& strand) {
+		Shard& shard = shardOf(strand->receiver);
+		std::lock_guard<std::mutex> shardLock(shard.mutex);
+		std::lock_guard<std::mutex> lock(strand->mutex);
+		if (!strand->jobs.empty()) {
+			return false;
+		}
+		strand->scheduled = false;
+		shard.strands.erase(strand->receiver);
+		return true;
+	}
+
+	void run(std::shared_ptr<Strand>& strand) {
+		for (size_t n = 0; n < StrandBatch; ++n) {
+			Job job;
+			bool empty;
+			{
+				std::lock_guard<std::mutex> lock(strand->mutex);
+				empty = strand->jobs.empty();
+				if (!empty) {
+					job = std::move(strand->jobs.front());
+					strand->jobs.pop_front();
+				}
+			}
+			if (empty) {
+				if (retire(strand)) { // checks again with the shard locked as well
+					return;
+				}
+				continue;
+			}
+			execute(job);
+		}
+		// Let this worker's other tasks run before the rest of this receiver's commands
+		schedule(Task{ std::move(strand), Job() }, true);
+	}
+
+	void work(size_t index) {
+		currentWorker() = CurrentWorker{ this, index };
+		for (;;) {
+			Task task;
+			if (take(index, task)) {
+				if (task.strand != nullptr) {
+					run(task.strand);
+				}
+				else {
+					execute(task.job);
+				}
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_idleMutex);
+			m_sleeping.fetch_add(1);
+			m_wake.wait(lock, [this]() {
+				return m_pending.load() > 0 || m_stopping;
+			});
+			m_sleeping.fetch_sub(1);
+			if (m_stopping && m_pending.load() == 0) {
+				return;
+			}
+		}
+	}
+
+public:
+	explicit CommandExecutor(size_t workers = std::max(1u, std::thread::hardware_concurrency())) :
+		m_workers(new Worker[workers]), m_workerCount(workers), m_shards(new Shard[ShardCount]),
+		m_pending(0), m_sleeping(0), m_nextWorker(0), m_stopping(false), m_outstanding(0), m_executed(0), m_stolen(0) {
+		if (workers == 0) {
+			throw std::invalid_argument("A command executor needs at least one worker");
+		}
+		for (size_t i = 0; i < workers; ++i) {
+			m_threads.emplace_back(&CommandExecutor::work, this, i);
+		}
+	}
+
+	~CommandExecutor() {
+		drain();
+		{
+			std::lock_guard<std::mutex> lock(m_idleMutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& thread : m_threads) {
+			thread.join();
+		}
+	}
+
+	CommandExecutor(const CommandExecutor&) = delete;
+	CommandExecutor& operator=(const CommandExecutor&) = delete;
+
+	// Executes command whenever a worker is free
+	std::future<void> submit(std::unique_ptr<Command> command) {
+		Job job{ std::move(command), std::promise<void>() };
+		std::future<void> done = job.done.get_future();
+		m_outstanding.fetch_add(1);
+		schedule(Task{ nullptr, std::move(job) });
+		return done;
+	}
+
+	// Executes command after every command submitted earlier for the same receiver
+	template <typename Receiver>
+	std::future<void> submit(std::unique_ptr<Command> command, const Receiver& receiver) {
+		const void* key = &receiver;
+		Job job{ std::move(command), std::promise<void>() };
+		std::future<void> done = job.done.get_future();
+		m_outstanding.fetch_add(1);
+
+		std::shared_ptr<Strand> strand;
+		{
+			Shard& shard = shardOf(key);
+			std::lock_guard<std::mutex> shardLock(shard.mutex);
+			std::shared_ptr<Strand>& found = shard.strands[key];
+			if (found == nullptr) {
+				found = std::make_shared<Strand>(key);
+			}
+			std::lock_guard<std::mutex> lock(found->mutex);
+			found->jobs.push_back(std::move(job));
+			if (!found->scheduled) {
+				found->scheduled = true;
+				strand = found;
+			}
+		}
+		if (strand != nullptr) {
+			schedule(Task{ std::move(strand), Job() });
+		}
+		return done;
+	}
+
+	// Waits until every command submitted so far has been executed
+	void drain() {
+		std::unique_lock<std::mutex> lock(m_drainMutex);
+		m_drained.wait(lock, [this]() {
+			return m_outstanding.load() == 0;
+		});
+	}
+
+	size_t getWorkers() const {
+		return m_workerCount;
+	}
+
+	std::uint64_t getExecuted() const {
+		return m_executed.load(std::memory_order_relaxed);
+	}
+
+	// Tasks a worker took from another worker's queue
+	std::uint64_t getStolen() const {
+		return m_stolen.load(std::memory_order_relaxed);
+	}
+};
+
+void command_executor() {
+	Light lamp;
+	CommandExecutor executor(4);
+
+	// Executed one at a time and in this order, whichever workers pick them up
+	std::vector<std::future<void> > done;
+	for (int i = 0; i < 3; ++i) {
+		done.push_back(executor.submit(std::make_unique<FlipUpCommand>(lamp), lamp));
+		done.push_back(executor.submit(std::make_unique<FlipDownCommand>(lamp), lamp));
+	}
+	for (std::future<void>& command : done) {
+		command.get();
+	}
+	std::cout << executor.getExecuted() << " commands executed" << std::endl;
+}
+
+// A receiver keeping a running total, which would be corrupted by two commands at once
+class Tally {
+	std::uint64_t m_total;
+	std::uint64_t m_commands;
+
+public:
+	Tally() : m_total(0), m_commands(0) {}
+
+	void add(std::uint64_t value) {
+		m_total += value;
+		++m_commands;
+	}
+
+	std::uint64_t getTotal() const {
+		return m_total;
+	}
+
+	std::uint64_t getCommands() const {
+		return m_commands;
+	}
+};
+
+// Does some arithmetic, standing in for real work, and adds the result to a tally
+class TallyCommand : public Command {
+	Tally& m_tally;
+	std::uint64_t m_seed;
+	unsigned m_rounds;
+
+public:
+	TallyCommand(Tally& tally, std::uint64_t seed, unsigned rounds) : m_tally(tally), m_seed(seed), m_rounds(rounds) {}
+
+	static std::uint64_t compute(std::uint64_t x, unsigned rounds) {
+		for (unsigned i = 0; i < rounds; ++i) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+		}
+		return x % 1000;
+	}
+
+	void execute() override {
+		m_tally.add(compute(m_seed, m_rounds));
+	}
+};
+
+void command_executor_benchmark(size_t count = 1000000, unsigned rounds = 500) {
+	using Clock = std::chrono::steady_clock;
+	const size_t producers = 4;
+	const size_t receivers = 256;
+
+	std::uint64_t expected = 0;
+	for (size_t i = 0; i < count; ++i) {
+		expected += TallyCommand::compute(i + 1, rounds);
+	}
+
+	std::cout << std::setw(10) << "workers" << std::setw(20) << "commands/s" << std::setw(12) << "stolen" << std::endl;
+
+	size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	for (size_t workers = 1; workers <= std::max<size_t>(cores, 4); workers *= 2) {
+		std::vector<Tally> tallies(receivers);
+		std::uint64_t stolen = 0;
+
+		auto start = Clock::now();
+		{
+			CommandExecutor executor(workers);
+			std::vector<std::thread> threads;
+			for (size_t p = 0; p < producers; ++p) {
+				threads.emplace_back([&executor, &tallies, p, count, rounds, producers]() {
+					for (size_t i = p; i < count; i += producers) {
+						Tally& tally = tallies[i % tallies.size()];
+						executor.submit(std::make_unique<TallyCommand>(tally, i + 1, rounds), tally);
+					}
+				});
+			}
+			for (std::thread& thread : threads) {
+				thread.join();
+			}
+			executor.drain();
+			stolen = executor.getStolen();
+		}
+		auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::uint64_t total = 0, commands = 0;
+		for (const Tally& tally : tallies) {
+			total += tally.getTotal();
+			commands += tally.getCommands();
+		}
+		if (total != expected || commands != count) {
+			throw std::logic_error("Commands for a receiver ran at the same time or were lost");
+		}
+
+		std::cout << std::setw(10) << workers << std::setw(20) << static_cast<std::uint64_t>(static_cast<double>(count) / elapsed)
+			<< std::setw(12) << stolen << std::endl;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,210 @@
+#pragma once
+
+/* An in-place command
+
+A queue of commands of different types is usually a queue of std::unique_ptr<Command>,
+or of std::function, and either way each command is allocated on the heap on its own
+(std::function only keeps very small callables, two pointers in libstdc++, inside
+itself). InplaceCommand keeps the command inside itself instead, in a buffer of
+Capacity bytes, so a std::vector<InplaceCommand<> > holds its commands contiguously and
+queuing one allocates nothing.
+
+It takes any Command object by value (calling its execute()) and any callable taking
+no arguments, such as a lambda. Commands too big or too aligned for the buffer are
+rejected at compile time, rather than quietly put on the heap; give the buffer a
+larger Capacity for those. InplaceCommand is move only, so commands owning resources
+(a lambda capturing a std::unique_ptr, say) can be queued too, and moving one must not
+throw.
+
+Rather than a vtable, each stored type gets a table of three functions (execute, move
+and destroy) written for that type, so the command is always destroyed through its
+own destructor, whether or not its base class has a virtual one. */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <stdexcept>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "4.2_Command.h"
+#include "4.2.1_CommandExecutor.h"
+
+template <size_t Capacity = 4 * sizeof(void*), size_t Alignment = alignof(std::max_align_t)>
+class InplaceCommand {
+	struct Operations {
+		void (*execute)(void* command);
+		void (*move)(void* from, void* to); // move constructs at to and destroys from
+		void (*destroy)(void* command);
+	};
+
+	template <typename T>
+	static void executeCommand(void* command, std::true_type /* is a Command */) {
+		static_cast<T*>(command)->T::execute(); // no need for a virtual call, the type is known
+	}
+
+	template <typename T>
+	static void executeCommand(void* command, std::false_type /* is a callable */) {
+		(*static_cast<T*>(command))();
+	}
+
+	template <typename T>
+	static const Operations* operationsFor() {
+		static const Operations operations = {
+			[](void* command) {
+				executeCommand<T>(command, std::is_base_of<Command, T>());
+			},
+			[](void* from, void* to) {
+				new (to) T(std::move(*static_cast<T*>(from)));
+				static_cast<T*>(from)->~T();
+			},
+			[](void* command) {
+				static_cast<T*>(command)->~T();
+			}
+		};
+		return &operations;
+	}
+
+	typename std::aligned_storage<Capacity, Alignment>::type m_storage;
+	const Operations* m_operations; // null when empty
+
+public:
+	InplaceCommand() noexcept : m_operations(nullptr) {}
+
+	template <typename F, typename T = typename std::decay<F>::type,
+		typename = typename std::enable_if<!std::is_same<T, InplaceCommand>::value>::type>
+	InplaceCommand(F&& command) : m_operations(operationsFor<T>()) {
+		static_assert(sizeof(T) <= Capacity, "The command does not fit: give InplaceCommand a larger Capacity");
+		static_assert(Alignment % alignof(T) == 0, "The command needs a stricter Alignment than InplaceCommand's");
+		static_assert(std::is_nothrow_move_constructible<T>::value, "Commands must be movable without throwing");
+		new (&m_storage) T(std::forward<F>(command));
+	}
+
+	InplaceCommand(InplaceCommand&& other) noexcept : m_operations(other.m_operations) {
+		if (m_operations != nullptr) {
+			m_operations->move(&other.m_storage, &m_storage);
+			other.m_operations = nullptr;
+		}
+	}
+
+	InplaceCommand& operator=(InplaceCommand&& other) noexcept {
+		if (this != &other) {
+			reset();
+			if (other.m_operations != nullptr) {
+				other.m_operations->move(&other.m_storage, &m_storage);
+				m_operations = other.m_operations;
+				other.m_operations = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	InplaceCommand(const InplaceCommand&) = delete;
+	InplaceCommand& operator=(const InplaceCommand&) = delete;
+
+	~InplaceCommand() {
+		reset();
+	}
+
+	// Throws std::bad_function_call if there is no command, as std::function does
+	void execute() {
+		if (m_operations == nullptr) {
+			throw std::bad_function_call();
+		}
+		m_operations->execute(&m_storage);
+	}
+
+	void operator()() {
+		execute();
+	}
+
+	// Destroys the command, if any
+	void reset() noexcept {
+		if (m_operations != nullptr) {
+			m_operations->destroy(&m_storage);
+			m_operations = nullptr;
+		}
+	}
+
+	explicit operator bool() const noexcept {
+		return m_operations != nullptr;
+	}
+};
+
+void command_inplace() {
+	Light lamp;
+	std::unique_ptr<int> presses = std::make_unique<int>(0);
+
+	std::vector<InplaceCommand<> > queue;
+	queue.emplace_back(FlipUpCommand(lamp));
+	queue.emplace_back(FlipDownCommand(lamp));
+	queue.emplace_back([&lamp]() {
+		lamp.turnOn();
+		lamp.turnOff();
+	});
+	// Move only, owning what it captured
+	queue.emplace_back([counter = std::move(presses)]() {
+		std::cout << "Pressed " << ++*counter << " time(s)" << std::endl;
+	});
+
+	for (InplaceCommand<>& command : queue) {
+		command.execute();
+	}
+	queue[3].execute();
+	std::cout << "Each command takes " << sizeof(InplaceCommand<>) << " bytes in the queue" << std::endl;
+}
+
+void command_inplace_benchmark(size_t count = 1000000, int repetitions = 10) {
+	using Clock = std::chrono::steady_clock;
+	std::vector<Tally> tallies(64);
+
+	// Fills a queue with count commands, executes them and empties it, returning ns per command
+	auto measure = [count, repetitions, &tallies](auto enqueue, auto executeAll, auto clear) {
+		auto start = Clock::now();
+		for (int r = 0; r < repetitions; ++r) {
+			for (size_t i = 0; i < count; ++i) {
+				enqueue(TallyCommand(tallies[i % tallies.size()], i + 1, 1));
+			}
+			executeAll();
+			clear();
+		}
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / static_cast<double>(count * repetitions);
+	};
+
+	std::vector<std::unique_ptr<Command> > pointers;
+	double pointerTime = measure(
+		[&pointers](TallyCommand&& command) { pointers.push_back(std::make_unique<TallyCommand>(command)); },
+		[&pointers]() { for (auto& command : pointers) command->execute(); },
+		[&pointers]() { pointers.clear(); });
+
+	std::vector<std::function<void()> > functions;
+	double functionTime = measure(
+		[&functions](TallyCommand&& command) { functions.emplace_back([command]() mutable { command.execute(); }); },
+		[&functions]() { for (auto& command : functions) command(); },
+		[&functions]() { functions.clear(); });
+
+	std::vector<InplaceCommand<> > inplace;
+	double inplaceTime = measure(
+		[&inplace](TallyCommand&& command) { inplace.emplace_back(std::move(command)); },
+		[&inplace]() { for (auto& command : inplace) command.execute(); },
+		[&inplace]() { inplace.clear(); });
+
+	std::uint64_t commands = 0;
+	for (const Tally& tally : tallies) {
+		commands += tally.getCommands();
+	}
+	if (commands != 3 * count * static_cast<size_t>(repetitions)) {
+		throw std::logic_error("Commands were lost");
+	}
+
+	std::cout << std::setw(28) << "queue of" << std::setw(16) << "ns/command" << std::endl;
+	std::cout << std::setw(28) << "std::unique_ptr<Command>" << std::setw(16) << pointerTime << std::endl;
+	std::cout << std::setw(28) << "std::function<void()>" << std::setw(16) << functionTime << std::endl;
+	std::cout << std::setw(28) << "InplaceCommand<>" << std::setw(16) << inplaceTime << std::endl;
+}
\ No newline at end of file
@@ -18,6 +18,7 @@ time based on the user's actions. */
 class Command {
 public:
 	virtual void execute() = 0; // Pure virtual
+	virtual ~Command() = default; // commands may be owned, and deleted, through this interface
 };
 
 // Receiver class
@@ -2,6 +2,8 @@ C:
 
 cd C:\Users\AnthonyDas\Documents\GitHub\Cpp_Design_Patterns\Cpp_Design_Patterns
 
+g++ -Wall -Wconversion -std=c++14 -O2 -shared plugins\english_greeter.cpp -o plugins\english_greeter.dll
+g++ -Wall -Wconversion -std=c++14 -O2 -shared plugins\stale_greeter.cpp -o plugins\stale_greeter.dll
 g++ -Wall -Wconversion -std=c++14 -mtune=native -O3 main.cpp -o main.exe
 
 
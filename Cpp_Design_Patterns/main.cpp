@@ -9,11 +9,31 @@
 #include "3.2_Bridge.h"
 #include "3.3_Composite.h"
 #include "3.3.1_Decorator.h"
+#include "3.3.2_MixinDecorator.h"
 #include "3.4_Facade.h"
 #include "3.5_Flyweight.h"
+#include "3.5.1_FlyweightFontPool.h"
+#include "3.5.2_FlyweightDocument.h"
+#include "3.5.3_FlyweightMemory.h"
+#include "3.5.4_MappedFlyweightDocument.h"
+#include "3.5.5_FlyweightGlyphCache.h"
+#include "3.6_Proxy.h"
+#include "3.6.1_PackedBitVector.h"
+#include "3.6.2_SharedMemoryRemoteProxy.h"
+#include "3.6.3_ShardedLruCache.h"
+#include "3.7_CuriouslyRecurringTemplate.h"
+#include "3.7.1_LifetimeProfiler.h"
+#include "3.7.2_ExpressionTemplates.h"
+#include "3.7.3_StaticInterfaces.h"
+#include "3.8.1_PluginLoader.h"
 
 #include "4.1_ChainOfResponsibility.h"
+#include "4.1.1_CompiledChain.h"
+#include "4.1.2_PipelinedChain.h"
+#include "4.1.3_AdaptiveChain.h"
 #include "4.2_Command.h"
+#include "4.2.1_CommandExecutor.h"
+#include "4.2.2_InplaceCommand.h"
 #include "4.3_Interpreter.h"
 #include "4.4_Iterator.h"
 #include "4.5_Mediator.h"
@@ -105,12 +125,38 @@ int main() {
 	bridge();
 	composite();
 	decorator1();
+	decorator_sealed();
 	decorator2();
+	decorator_message();
+	mixin_decorator();
 	facade();
+	facade_concurrent();
+	facade_batching();
 	flyweight();
+	flyweight_pool();
+	flyweight_document();
+	flyweight_mapped();
+	flyweight_glyph_cache();
+	proxy();
+	proxy_lazy();
+	proxy_caching();
+	proxy_bit_vector();
+	proxy_remote();
+	crtp_counter();
+	crtp_profiler();
+	crtp_expression_templates();
+	crtp_static_interfaces();
+	ibp_plugins();
+	ibp_plugins_check();
 	
 	chain_of_responsibility();
+	chain_of_responsibility_compiled();
+	chain_of_responsibility_batch();
+	chain_of_responsibility_pipelined();
+	chain_of_responsibility_adaptive();
 	command();
+	command_executor();
+	command_inplace();
 	interpreter();
 	iterator1();
 	iterator2();
@@ -123,6 +169,25 @@ int main() {
 	template_pattern();
 	visitor();
 
+#ifdef RUN_BENCHMARKS
+	decorator_benchmark();
+	decorator_message_benchmark();
+	mixin_decorator_benchmark();
+	flyweight_document_benchmark();
+	flyweight_memory_benchmark();
+	proxy_bit_vector_benchmark();
+	proxy_remote_benchmark();
+	crtp_counter_benchmark();
+	crtp_profiler_benchmark();
+	crtp_expression_templates_benchmark();
+	crtp_dispatch_benchmark();
+	chain_of_responsibility_compiled_benchmark();
+	chain_of_responsibility_batch_benchmark();
+	chain_of_responsibility_pipelined_benchmark();
+	command_executor_benchmark();
+	command_inplace_benchmark();
+#endif
+
 	std::cout << "Finished - please type something to quit";
 	int dummy;
 	std::cin >> dummy;
@@ -0,0 +1,33 @@
+/* An example plugin for PluginLoader, implementing Greeter. "main - laptop.bat" and the
+Visual Studio project build it into plugins/ before main; by hand, from the directory
+above, build it with
+
+	g++ -std=c++14 -shared -fPIC plugins/english_greeter.cpp -o plugins/english_greeter.so
+
+It is not part of the application itself. */
+
+#include "../3.8.1_PluginLoader.h"
+
+class EnglishGreeter : public Greeter {
+public:
+	std::string greet(const std::string& name) const override {
+		return "Hello " + name;
+	}
+};
+
+IBP_PLUGIN_EXPORT unsigned ibp_plugin_abi_version() {
+	return plugins::AbiVersion;
+}
+
+IBP_PLUGIN_EXPORT void* ibp_plugin_create(const char* interfaceName) {
+	if (std::strcmp(interfaceName, Greeter::interfaceName()) == 0) {
+		return static_cast<Greeter*>(new EnglishGreeter()); // cast to the interface before void*
+	}
+	return nullptr;
+}
+
+IBP_PLUGIN_EXPORT void ibp_plugin_destroy(const char* interfaceName, void* instance) {
+	if (std::strcmp(interfaceName, Greeter::interfaceName()) == 0) {
+		delete static_cast<Greeter*>(instance);
+	}
+}
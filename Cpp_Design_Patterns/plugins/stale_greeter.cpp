@@ -0,0 +1,17 @@
+/* A plugin built against a plugin ABI other than the application's, which
+PluginLoader must refuse to use. It is built like english_greeter.cpp:
+
+	g++ -std=c++14 -shared -fPIC plugins/stale_greeter.cpp -o plugins/stale_greeter.so */
+
+#include "../3.8.1_PluginLoader.h"
+
+IBP_PLUGIN_EXPORT unsigned ibp_plugin_abi_version() {
+	return plugins::AbiVersion + 1;
+}
+
+// Never called: the loader checks the ABI version first
+IBP_PLUGIN_EXPORT void* ibp_plugin_create(const char*) {
+	return nullptr;
+}
+
+IBP_PLUGIN_EXPORT void ibp_plugin_destroy(const char*, void*) {}